@@ -0,0 +1,113 @@
+"""
+Embed the gzipped web portal into the firmware (PROGMEM), see EspClient::_setupAssets().
+
+Runs as a PlatformIO pre-build script (extra_scripts = pre:web/embed_portal.py), or by hand:
+    python3 web/embed_portal.py
+It writes include/portal_gz.h with each asset gzipped and its strong ETag (content hash).
+The asset references in main.html get a ?v=<hash> suffix, so the browser can cache the assets
+forever and still picks up a new portal after a firmware update.
+The header is rewritten only if the content changed, to keep incremental builds.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+try:
+    Import("env")  # noqa: F821, PlatformIO (SCons) build
+    PROJECT_DIR = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, 'web')
+HEADER = os.path.join(PROJECT_DIR, 'include', 'portal_gz.h')
+
+# (file, URL path, content type), main.html first since it refers to the others
+ASSETS = [
+    ('main.html', '/', 'text/html'),
+    ('style.css', '/style.css', 'text/css'),
+    ('espman.js', '/espman.js', 'application/javascript'),
+    ('filedrag.js', '/filedrag.js', 'application/javascript'),
+]
+
+
+def digest(data):
+    return hashlib.sha1(data).hexdigest()[:16]
+
+
+def versioned(html, hashes):
+    """Append ?v=<hash> to the href/src references of the embedded assets."""
+    for name, hash in hashes.items():
+        html = re.sub(r'((?:href|src)=")%s(")' % re.escape(name), r'\g<1>%s?v=%s\g<2>' % (name, hash[:8]), html)
+    return html
+
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 20):
+        lines.append('    ' + ', '.join('0x%02x' % b for b in data[i:i + 20]) + ',')
+    return 'static const uint8_t %s[] PROGMEM = {\n%s\n};\n' % (name, '\n'.join(lines))
+
+
+def generate():
+    contents = {}
+    for name, _, _ in ASSETS:
+        with open(os.path.join(WEB_DIR, name), 'rb') as f:
+            contents[name] = f.read()
+
+    # hash the referenced assets first, the page embeds their versions
+    hashes = {name: digest(data) for name, data in contents.items() if name != 'main.html'}
+    contents['main.html'] = versioned(contents['main.html'].decode('utf-8'), hashes).encode('utf-8')
+
+    arrays = []
+    entries = []
+    bundle = hashlib.sha1()
+    for name, path, type in ASSETS:
+        data = gzip.compress(contents[name], 9, mtime=0)  # mtime 0: same input, same output
+        hash = digest(contents[name])
+        bundle.update(hash.encode())
+
+        symbol = 'PORTAL_' + re.sub(r'\W', '_', name)
+        arrays.append(c_array(symbol, data))
+        entries.append('    {"%s", "%s", %s, %d, "\\"%s\\""},' % (path, type, symbol, len(data), hash))
+        print('embed_portal: %s %d -> %d bytes, %s' % (name, len(contents[name]), len(data), hash))
+
+    return '''// Generated by web/embed_portal.py from the web/ sources, do not edit
+#pragma once
+
+#include <Arduino.h>
+
+#define PORTAL_HASH "%s" // hash of the whole bundle
+
+struct PortalAsset
+{
+    const char *path; // URL path
+    const char *type; // content type
+    const uint8_t *data; // gzipped content in PROGMEM
+    size_t size;
+    const char *etag; // strong ETag, quoted
+};
+
+%s
+static const PortalAsset PORTAL_ASSETS[] = {
+%s
+};
+''' % (bundle.hexdigest()[:16], '\n'.join(arrays), '\n'.join(entries))
+
+
+def main():
+    header = generate()
+
+    if os.path.exists(HEADER):
+        with open(HEADER) as f:
+            if f.read() == header:
+                return
+
+    os.makedirs(os.path.dirname(HEADER), exist_ok=True)
+    with open(HEADER, 'w') as f:
+        f.write(header)
+    print('embed_portal: wrote %s' % HEADER)
+
+
+main()
@@ -72,6 +72,7 @@ function addSensor(sensor) {
     const div = document.createElement("div");
     div.id = sensorId;
     div.className = 'sensor'
+    div.settings = sensor; // keep the settings not edited on this form, e.g., channel alarms
 
     // add '-' button
     const btn = document.createElement("input");
@@ -112,7 +113,8 @@ function addSensor(sensor) {
         ['', ['']],
         ['HC-SR04', ['HC-SR04', ['pinTrig', 'pinEcho']]],
         ['DHT11', ['DHT11, temp/humi', ['pinData']]],
-        ['VL53L0X', ['VL53L0X, laser']]
+        ['VL53L0X', ['VL53L0X, laser']],
+        ['Fusion', ['Fusion, redundant distance']]
     ]);
 
     // PINS definition
@@ -245,6 +247,13 @@ function getConfigJson() {
                 if (hasPin) sensor.pins = pins;
             }
         }
+
+        // carry over the settings not shown on the form
+        if (sitm.settings) {
+            for (const key in sitm.settings) {
+                if (!['name', 'type', 'pins'].includes(key)) sensor[key] = sitm.settings[key];
+            }
+        }
         data.sensors.push(sensor);
     }
 
@@ -376,7 +385,7 @@ async function getFileList() {
             Output("<b>Get filelist:</b><pre>" + JSON.stringify(js) + "</pre>")
 
             $id('filelist').value = '';
-            $id('diskinfo').innerHTML = 'Used:' + js.used.toLocaleString() + ' (' + js.used / js.max * 100 + '%), Max:' + js.max.toLocaleString();
+            $id('diskinfo').innerHTML = 'Used:' + js.used.toLocaleString() + ' (' + (js.used / js.max * 100).toFixed(1) + '%), Max:' + js.max.toLocaleString();
             addTable(js.files);
 
         } else {
@@ -465,6 +474,81 @@ function addTable(flist) {
     myTableDiv.appendChild(table);
 }
 
+//---------------------------------------------------------------------------
+// Latest measures from the device cache, updated live by Server-Sent Events.
+// Reading the cache never triggers a sensor read on the device.
+
+async function getMeasures() {
+    try {
+        const response = await fetch('/api/measure');
+        if (response.ok) {
+            const js = await response.json();
+            addMeasureTable(js.measures);
+        } else {
+            alert(response.status);
+        }
+    } catch (e) {
+        alert(e.message);
+    }
+}
+
+function addMeasureTable(measures) {
+    const myTableDiv = $id("measurelist");
+
+    myTableDiv.innerHTML = '';
+
+    const table = document.createElement('TABLE');
+    table.id = 'tbl_measurelist';
+
+    const tr = document.createElement('TR');
+    table.appendChild(tr);
+
+    const header = ['Sensor', 'Channel', 'Value', 'Age (s)']
+    for (let j = 0; j < header.length; j++) {
+        const th = document.createElement('TH');
+        th.appendChild(document.createTextNode(header[j]));
+        tr.appendChild(th);
+    }
+
+    for (let i = 0; i < measures.length; i++) {
+        const m = measures[i];
+        const tr = document.createElement('TR');
+        tr.id = 'measure_' + m.sensor + '_' + m.channel;
+        if (m.stale) tr.className = 'stale';
+        table.appendChild(tr);
+
+        const cells = [m.sensor, m.channel, m.value.toFixed(2), (m.age / 1000).toFixed(0)];
+        for (let j = 0; j < cells.length; j++) {
+            const td = document.createElement('TD');
+            td.appendChild(document.createTextNode(cells[j]));
+            tr.appendChild(td);
+        }
+    }
+    myTableDiv.appendChild(table);
+}
+
+function startMeasureEvents() {
+    if (!window.EventSource) return;
+
+    const source = new EventSource('/api/events');
+    source.addEventListener('measure', function(e) {
+        const m = JSON.parse(e.data);
+        const tr = $id('measure_' + m.sensor + '_' + m.channel);
+        if (tr == null) {
+            getMeasures(); // new channel, reload the table
+            return;
+        }
+
+        tr.className = '';
+        tr.cells[2].innerHTML = m.value.toFixed(2);
+        tr.cells[3].innerHTML = '0';
+    }, false);
+}
+
+$id('get_measure').onclick = async (event) => {
+    getMeasures();
+}
+
 $id('clear').onclick = async (event) => {
     $id("output").innerHTML = '';
 }
@@ -472,5 +556,7 @@ $id('clear').onclick = async (event) => {
 document.body.onload = function() {
     getFileList()
     getConfig();
+    getMeasures();
+    startMeasureEvents();
     $id('tab_config').click();
 };
\ No newline at end of file
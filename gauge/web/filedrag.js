@@ -35,32 +35,49 @@ filedrag.js - File Drag & Drop
 		uploadFiles(files);
 	}
 	
+	// CRC-32 table (IEEE, as zlib), checked by the device against the received content
+	const crcTable = (function() {
+		const table = new Uint32Array(256);
+		for (let n = 0; n < 256; n++) {
+			let c = n;
+			for (let k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320 ^ (c >>> 1)) : (c >>> 1);
+			table[n] = c >>> 0;
+		}
+		return table;
+	})();
+
+	function crc32(bytes) {
+		let crc = 0xFFFFFFFF;
+		for (let i = 0; i < bytes.length; i++) crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >>> 8);
+		return ((crc ^ 0xFFFFFFFF) >>> 0).toString(16).padStart(8, '0');
+	}
+
+	// One request per file, so each one is checked against its own X-CRC32
 	async function uploadFiles(files) {
 		
-		const formData = new FormData(); // Create a new FormData object.
-		
-		// Loop through each of the selected files.
 		for (const file of files) {
 			ParseFile(file); // display file information to output window
+
+			const formData = new FormData(); // Create a new FormData object.
 			formData.append('files[]', file, file.name); // Add the file to the request.
+
+			const settings = {
+				method: 'POST',
+				headers: { 'X-CRC32': crc32(new Uint8Array(await file.arrayBuffer())) },
+				body: formData
+			};
+			
+			try {
+				const response = await fetch('/api/files/upload', settings);
+				if (!response.ok){
+					Message("<p>Upload failed: <strong>" + file.name + "</strong> (" + response.status + ")</p>");
+				}
+			} catch(e) {
+				alert(e.message);
+			}  
 		}
 
-		const settings = {
-			method: 'POST',
-			body: formData
-		};
-		
-		try {
-			const response = await fetch('/api/files/upload', settings);
-			if (response.ok){
-				
-				getFileList(); // refresh the file list on the page
-			} else {
-				alert(response.status);
-			}
-		} catch(e) {
-			alert(e.message);
-		}  
+		getFileList(); // refresh the file list on the page
 	}
 
 	// output file information
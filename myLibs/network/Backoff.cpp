@@ -0,0 +1,23 @@
+#include "Backoff.hpp"
+
+#ifdef ESP32
+#include <esp_random.h>
+#endif
+
+uint32_t Backoff::next()
+{
+    uint32_t d = _base << min(_attempts, (uint16_t)16);
+    if (d > _cap || d < _base) // capped, or shifted out
+        d = _cap;
+
+    if (_attempts < UINT16_MAX)
+        _attempts++;
+
+    // hardware RNG, the boards start with the same software seed
+#ifdef ESP8266
+    uint32_t r = ESP.random();
+#elif defined(ESP32)
+    uint32_t r = esp_random();
+#endif
+    return d / 4 + r % (d - d / 4 + 1);
+}
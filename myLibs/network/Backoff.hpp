@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+Exponential backoff with randomized jitter. The n-th retry delay is drawn uniformly in
+[d/4, d] with d = min(cap, base * 2^n), so devices that lost the broker at the same time do not
+retry in lockstep. See tools/reconnect_sim.py for the effect on a fleet.
+*/
+class Backoff
+{
+public:
+    Backoff(uint32_t base, uint32_t cap) : _base(base), _cap(cap) {};
+
+    uint32_t next();                   // delay (ms) before the next attempt
+    void clear() { _attempts = 0; };   // connected: start over from base
+    uint16_t attempts() const { return _attempts; };
+
+private:
+    uint32_t _base; // ms
+    uint32_t _cap;  // ms
+    uint16_t _attempts = 0;
+};
@@ -0,0 +1,40 @@
+#include "Clock.hpp"
+
+#include <sys/time.h>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+uint64_t monoUs()
+{
+#ifdef ESP8266
+    return micros64();
+#elif defined(ESP32)
+    return esp_timer_get_time();
+#endif
+}
+
+bool clockSynced()
+{
+    return time(nullptr) > EPOCH_VALID;
+}
+
+uint64_t epochMs(uint64_t mono)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec <= EPOCH_VALID)
+        return 0;
+
+    // offset now, the SNTP adjustments since the capture are taken in
+    int64_t offset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (int64_t)monoUs();
+    return (uint64_t)((int64_t)mono + offset) / 1000;
+}
+
+int writeStamp(char *out, size_t size, uint64_t captureUs, uint32_t acqUs)
+{
+    uint64_t ms = epochMs(captureUs);
+    int n = snprintf(out, size, "{\"timestamp\":%lld,\"ms\":%llu,\"acq\":%lu", (long long)(ms / 1000),
+                     (unsigned long long)ms, (unsigned long)acqUs);
+    return min(n, (int)size - 1);
+}
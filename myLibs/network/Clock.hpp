@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define EPOCH_VALID 1617460172 // minimum valid epoch, time() counts from 0 at boot until NTP synced
+
+// Monotonic time since boot (us), 64 bits, does not wrap. Capture timestamps are taken with it.
+uint64_t monoUs();
+
+// True once the wall clock is synced by NTP
+bool clockSynced();
+
+// Epoch time (ms) of a monoUs() time through the current offset between the two clocks,
+// 0 if the clock is not synced yet. Valid for times before the sync as well.
+uint64_t epochMs(uint64_t mono);
+
+// Open a JSON payload with the capture time of a sample, return its length, e.g.,
+// {"timestamp":1700000000,"ms":1700000000123,"acq":25210
+// timestamp (s) for the existing consumers, ms the epoch time of captureUs, acq the acquisition time (us).
+// Before the clock sync the times are placeholders, see MqttQueue::pushStamped().
+int writeStamp(char *out, size_t size, uint64_t captureUs, uint32_t acqUs);
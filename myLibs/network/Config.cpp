@@ -37,6 +37,11 @@ bool Config::loadConfig(const char *filename)
 
     // Module name
     module = doc["module"].as<String>();
+    if (module.length() >= MODULE_LEN)
+    {
+        module.remove(MODULE_LEN - 1); // the topics must fit MQTT_TOPIC_LEN
+        Serial.println(F("Module name too long, truncated"));
+    }
     Serial.printf("MODULE %s\n", module.c_str()); // module name, used as mqttClientName, otaHost
 
     // Wifi
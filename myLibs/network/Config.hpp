@@ -3,7 +3,8 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
-#define JSON_CAPACITY 1024
+#define JSON_CAPACITY 2048 // room for per channel sensor settings
+#define MODULE_LEN 20      // Max module name length (including null terminator), it prefixes every MQTT topic
 
 class Config
 {
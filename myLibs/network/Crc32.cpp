@@ -0,0 +1,18 @@
+#include "Crc32.hpp"
+
+// Nibble table (64 bytes) instead of the usual 1KB byte table, fast enough for flash writes
+static const uint32_t CRC32_NIBBLE[16] PROGMEM = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ pgm_read_dword(&CRC32_NIBBLE[crc & 0x0f]);
+        crc = (crc >> 4) ^ pgm_read_dword(&CRC32_NIBBLE[crc & 0x0f]);
+    }
+    return ~crc;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Standard CRC-32 (IEEE 802.3, same as zlib/PNG/JS implementations), computed incrementally:
+// crc = crc32Update(0, first, n); crc = crc32Update(crc, next, m); ...
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t length);
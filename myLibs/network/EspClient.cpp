@@ -3,6 +3,7 @@
 #include <ArduinoOTA.h>
 #include <FS.h>
 #include <LittleFS.h>
+#include <new>
 
 #include "AsyncJson.h"
 #include "ArduinoJson.h"
@@ -12,9 +13,27 @@
 #include "sr04.hpp"
 #include "dht11.hpp"
 #include "vl53l0x.hpp"
+#include "fusion.hpp"
+
+// Web portal embedded in the firmware, generated by gauge/web/embed_portal.py at build time
+#if __has_include("portal_gz.h")
+#include "portal_gz.h"
+#define PORTAL_EMBEDDED
+#endif
 
 Config &cfg = Config::instance();
 JTimer &jTimer = JTimer::instance();
+MqttQueue &mqttQueue = MqttQueue::instance();
+Metrics &metrics = Metrics::instance();
+
+// Timer action names for the metrics labels, same order as the action IDs
+static const char *const ACTION_NAMES[] = {"heartbeat", "measure", "diag", "memory", "connect", "sync_ntp",
+                                           "restart", "cmd_measure", "cmd_trace", "cmd_profile"};
+Trace &trace = Trace::instance();
+Profiler &profiler = Profiler::instance();
+MemGuard &memGuard = MemGuard::instance();
+OtaUpdate &otaUpdate = OtaUpdate::instance();
+Resolver &resolver = Resolver::instance();
 
 EspClient &EspClient::instance()
 {
@@ -28,23 +47,52 @@ void EspClient::setup()
     Serial.println("\n\nsetup()");
 #endif
 
-    if (!cfg.loadConfig())
+    BootReport &boot = metrics.boot;
+    boot.start = BootReport::now();
+
+#ifdef ESP8266
+    TRACE(EV_BOOT, ESP.getResetInfoPtr()->reason);
+#elif defined(ESP32)
+    TRACE(EV_BOOT, esp_reset_reason());
+#endif
+
+    bool loaded = cfg.loadConfig();
+    boot.config = BootReport::now();
+    trace.saveOnCrash = cfg.doc["trace"]["crash"] | false;
+
+    // Low-memory governor free heap thresholds, e.g., "memory": {"pause": 12000, "shrink": 9000, "defer": 7000, "restart": 4000}
+    JsonObject memory = cfg.doc["memory"];
+    memGuard.reset(memory["pause"] | 12000, memory["shrink"] | 9000, memory["defer"] | 7000, memory["restart"] | 4000);
+    if (memGuard.restore())
     {
-        Serial.println(F("Failed to load configuration."));
-        setupPortal(true); // blocking mode so other setup is onhold
+        // back from a low-memory restart
+        _autoMode = memGuard.saved.autoMode;
+        _ledBlink = memGuard.saved.ledBlink;
+        Serial.printf("Low-memory restart %u, min heap %u\n", memGuard.saved.restarts, memGuard.saved.minFree);
     }
-    else
+
+    setupPortal();
+    boot.portal = BootReport::now();
+
+    if (!loaded)
     {
-        setupPortal(false);
+        // Portal only, the rest of the setup is on hold until configured and restarted
+        Serial.println(F("Failed to load configuration."));
+        return;
     }
 
     _setupWifi();
+    boot.wifi = BootReport::now();
     _setupOTA();
+    boot.ota = BootReport::now();
     _setupMQTT();
+    boot.mqtt = BootReport::now();
 
     _connectToWifi();
+    boot.join = BootReport::now();
 
     _initSensors();
+    boot.sensors = BootReport::now();
 
     //-- Set time zone
     // Action Timer is created to do synch NTP server when WiFi gets connected
@@ -54,7 +102,11 @@ void EspClient::setup()
 
     //-- Create heartbeat and auto measurement timers
     jTimer.setInterval(this, ACT_HEARTBEAT, 1e3); // Send heartbeat signal (every 1 sec) to MQTT broker
-    jTimer.setInterval(this, ACT_MEASURE, 2e3);   // Measure every 2 seconds
+    jTimer.setInterval(this, ACT_MEASURE, MEASURE_TICK); // Check sensors due for measure
+    jTimer.setInterval(this, ACT_DIAG, DIAG_INTERVAL);    // Send diagnostic message
+    jTimer.setInterval(this, ACT_MEMORY, MEM_INTERVAL);   // Sample the heap
+
+    boot.setup = BootReport::now();
 }
 
 void EspClient::_initSensors()
@@ -69,46 +121,1021 @@ void EspClient::_initSensors()
         String type = sensor["type"].as<String>();
         String name = sensor["name"].as<String>();
 
-        Sensor *pSensor = NULL;
-        if (type == "HC-SR04")
+        Sensor *pSensor = NULL;
+        if (type == "HC-SR04")
+        {
+            uint8_t pinTrig = sensor["pins"]["pinTrig"];
+            uint8_t pinEcho = sensor["pins"]["pinEcho"];
+
+            // max distance (cm) bounding the echo wait: "range", else the tank bottom, else the sensor limit
+            JsonObject tank = sensor["tank"];
+            float range = tank.isNull() ? SR04_RANGE : (tank["offset"] | 0.0f) + (tank["height"] | 0.0f);
+            pSensor = new SR04(name.c_str(), pinTrig, pinEcho, sensor["range"] | range);
+        }
+        else if (type == "VL53L0X")
+        {
+            pSensor = new VL53L0X(name.c_str());
+        }
+        else if (type == "DHT11")
+        {
+            uint8_t pinData = sensor["pins"]["pinData"];
+            pSensor = new DH11(name.c_str(), pinData);
+        }
+        else if (type == "Fusion")
+        {
+            // Fuse the distance of redundant sensors defined before this one, e.g.,
+            // {"type": "Fusion", "name": "level", "sources": ["sr04", "vl53"], "tolerance": 5}
+            Fusion *pFusion = new Fusion(name.c_str(), sensor["tolerance"] | 5.0f);
+            for (JsonVariant source : sensor["sources"].as<JsonArray>())
+            {
+                Sensor *pSource = _findSensor(source.as<const char *>());
+                if (pSource == NULL || !pFusion->addSource(pSource, 0))
+                {
+                    Serial.print(F("Invalid fusion source: "));
+                    Serial.println(source.as<const char *>());
+                }
+            }
+            pSensor = pFusion;
+        }
+
+        if (pSensor != NULL)
+        {
+            pSensor->id = _sensors.size();
+            pSensor->setMqtt(cfg.module.c_str(), 0, false);
+            pSensor->setRaw(sensor["raw"] | true);
+
+            _configSampling(pSensor, sensor["sampling"]);
+            _configCycle(pSensor, sensor["cycle"]);
+            _configAir(pSensor, sensor["air"]);
+            _configTank(pSensor, sensor["tank"]);
+            _configChannels(pSensor, sensor["channels"]); // last, its "on" wins over the settings enabling a channel
+
+            Serial.print(F("Sensor init: "));
+            Serial.println(name);
+        }
+        else
+        {
+            Serial.print(F("Invalide sensor type: "));
+            Serial.println(type);
+        }
+
+        _sensors.push_back(pSensor);
+    }
+}
+
+// Apply per measure channel settings, e.g.,
+// "channels": {"distance": {"alarm": {...}, "band": {...}, "windows": [...]}, "heatindex": {"on": true}}
+void EspClient::_configChannels(Sensor *pSensor, JsonObject channels)
+{
+    for (JsonPair kv : channels)
+    {
+        int index = pSensor->channelIndex(kv.key().c_str());
+        if (index < 0)
+        {
+            Serial.print(F("Invalid channel: "));
+            Serial.println(kv.key().c_str());
+            continue;
+        }
+
+        JsonObject channel = kv.value().as<JsonObject>();
+
+        // Alarm rule: thresholds, hysteresis and rate of change limit (per minute). Missing limits are disabled.
+        // e.g., "alarm": {"low": 20, "high": 120, "hyst": 2, "rate": 5}
+        JsonObject alarm = channel["alarm"];
+        if (!alarm.isNull())
+            pSensor->setAlarm(index, alarm["low"] | NAN, alarm["high"] | NAN, alarm["hyst"] | 0.0f, alarm["rate"] | NAN);
+
+        // Report-by-exception band. Intervals are in seconds.
+        // e.g., "band": {"type": 2, "gap": 0.5, "pct": false, "hyst": 0.3, "min": 10, "max": 300}
+        JsonObject band = channel["band"];
+        if (!band.isNull())
+            pSensor->setBand(index, (BandType)(band["type"] | (int)BT_None), band["gap"] | 0.0f, band["pct"] | false,
+                             band["hyst"] | 0.0f, (band["min"] | 0UL) * 1000, (band["max"] | 0UL) * 1000);
+
+        // Aggregation windows in seconds, summary published at the end of each, e.g., "windows": [60, 3600]
+        for (JsonVariant period : channel["windows"].as<JsonArray>())
+            pSensor->addWindow(index, period.as<unsigned long>() * 1000);
+
+        // A channel set in config is active (computed, filtered and published) unless "on": false,
+        // which wins over the alarm, window, sampling or cycle settings of the channel
+        pSensor->setActive(index, channel["on"] | true);
+    }
+}
+
+// Sampling interval in seconds, either fixed or adaptive, e.g.,
+// "sampling": {"interval": 5}, or
+// "sampling": {"min": 1, "max": 600, "rate": 0.5, "ch": "distance"}
+// Adaptive sampling drops to the min interval while the channel changes faster than rate (per minute),
+// and backs off exponentially up to the max interval when it is flat. rate defaults to SAMPLER_RATE
+// (0.5 per minute) and must be positive, at 0 any noise would keep the interval at min.
+void EspClient::_configSampling(Sensor *pSensor, JsonObject sampling)
+{
+    pSensor->setInterval(MEASURE_INTERVAL);
+
+    if (sampling.isNull())
+        return;
+
+    if (sampling.containsKey("interval"))
+    {
+        pSensor->setInterval((sampling["interval"] | 2UL) * 1000);
+    }
+    else if (sampling.containsKey("min"))
+    {
+        int index = sampling.containsKey("ch") ? pSensor->channelIndex(sampling["ch"].as<const char *>()) : 0;
+        if (index < 0)
+        {
+            Serial.print(F("Invalid channel: "));
+            Serial.println(sampling["ch"].as<const char *>());
+            return;
+        }
+
+        float rate = sampling["rate"] | (float)SAMPLER_RATE;
+        if (rate <= 0)
+        {
+            Serial.print(F("Invalid sampling rate, using "));
+            Serial.println(SAMPLER_RATE);
+            rate = SAMPLER_RATE;
+        }
+
+        pSensor->setAdaptive(index, (sampling["min"] | 2UL) * 1000, (sampling["max"] | 600UL) * 1000, rate);
+    }
+}
+
+// High-rate acquisition with on-device pump cycle detection, e.g.,
+// "cycle": {"hz": 20, "start": 30, "stop": 10, "ch": "distance"}
+// The pump is on while the distance grows faster than start (per minute), and off once slower than stop.
+void EspClient::_configCycle(Sensor *pSensor, JsonObject cycle)
+{
+    if (cycle.isNull())
+        return;
+
+    int index = cycle.containsKey("ch") ? pSensor->channelIndex(cycle["ch"].as<const char *>()) : 0;
+    if (index < 0)
+    {
+        Serial.print(F("Invalid channel: "));
+        Serial.println(cycle["ch"].as<const char *>());
+        return;
+    }
+
+    float hz = constrain(cycle["hz"] | 20.0f, 1.0f, 20.0f);
+    pSensor->setCycle(index, hz, cycle["start"] | 30.0f, cycle["stop"] | 10.0f);
+}
+
+// Source of the air temperature and humidity on the measurement bus, used by the distance sensors.
+// Readings older than stale (seconds) are replaced by the fallback, e.g.,
+// "air": {"temp": "dh11/temperature", "humi": "dh11/humidity", "stale": 300, "fallback": {"temp": 24, "humi": 50}}
+// By default the first "temperature" and "humidity" channels on the bus are used.
+void EspClient::_configAir(Sensor *pSensor, JsonObject air)
+{
+    if (air.isNull())
+        return;
+
+    pSensor->setAir(air["temp"] | "temperature", air["humi"] | "humidity", (air["stale"] | 300UL) * 1000,
+                    air["fallback"]["temp"] | 24.0f, air["fallback"]["humi"] | 50.0f);
+}
+
+// Tank model to publish gallons and percent along with the distance. Dimensions in cm, e.g.,
+// "tank": {"shape": "oval", "height": 111.8, "width": 68.6, "length": 152.4, "offset": 5, "capacity": 275,
+//          "cal": [[100, 30], [60.8, 137.5]]}
+// shape: vertical (box, or upright cylinder of diameter width if no length), horizontal (cylinder of diameter height) or oval.
+// offset: distance from the sensor to the full level. cal: optional [distance, gallons] calibration points.
+void EspClient::_configTank(Sensor *pSensor, JsonObject tank)
+{
+    if (tank.isNull())
+        return;
+
+    float height = tank["height"] | 0.0f;
+    if (height <= 0)
+    {
+        Serial.println(F("Invalid tank height"));
+        return;
+    }
+
+    Tank *pTank = new Tank();
+    pTank->reset(Tank::shapeOf(tank["shape"] | "vertical"), height, tank["width"] | height, tank["length"] | 0.0f,
+                 tank["offset"] | 0.0f, tank["capacity"] | 0.0f);
+
+    for (JsonVariant point : tank["cal"].as<JsonArray>())
+        pTank->addCalibration(point[0], point[1]);
+
+    pTank->build();
+    pSensor->setTank(pTank);
+}
+
+void EspClient::loop()
+{
+    uint32_t start = micros();
+    bool tagging = profiler.isTagging();
+    uint32_t t = start;
+
+    // let JTimer do it's magic every time loop() is executed
+    jTimer.run();
+    if (tagging)
+        profiler.tag(PT_TIMERS, micros() - t), t = micros();
+
+    // High-rate sampling runs off the loop directly, timer ticks are too coarse for it
+    _acquire();
+    if (tagging)
+        profiler.tag(PT_ACQUIRE, micros() - t), t = micros();
+
+    // Send out pending MQTT messages as TCP send buffer space frees up
+#ifdef MQTT_TLS
+    mqttClient.loop(); // keep alive and incoming messages, AsyncMqttClient does it on the TCP events
+#endif
+    mqttQueue.drain();
+    if (tagging)
+        profiler.tag(PT_DRAIN, micros() - t), t = micros();
+
+    ArduinoOTA.handle(); // Listen for and handle OTA firmware upload requests.
+    if (tagging)
+        profiler.tag(PT_OTA, micros() - t);
+
+    uint32_t elapsed = micros() - start;
+    metrics.loop.add(elapsed);
+    profiler.tag(PT_LOOP, elapsed);
+    if (elapsed > TRACE_SLOW_US)
+        TRACE(EV_SLOW_LOOP, elapsed);
+}
+
+// Reply the measure cache, e.g.,
+// {"time":1700000000,"measures":[{"sensor":"sr04","channel":"distance","value":50.1,"timestamp":1699999998,"age":1520,"stale":false}]}
+// age is in ms. A measure is stale if older than the stale parameter (seconds), MEASURE_STALE by default.
+void EspClient::_sendMeasures(AsyncWebServerRequest *request)
+{
+    unsigned long stale = request->hasParam("stale") ? request->getParam("stale")->value().toInt() * 1000UL : MEASURE_STALE;
+    unsigned long now = millis();
+    time_t epoch = time(NULL);
+
+    MeasureBus &bus = MeasureBus::instance();
+    DynamicJsonDocument doc(256 + bus.size() * 160);
+    doc["time"] = epoch;
+    JsonArray measures = doc.createNestedArray("measures");
+
+    for (int i = 0; i < bus.size(); i++)
+    {
+        const MeasureBus::Entry &entry = bus.entry(i);
+        unsigned long age = now - entry.ms;
+
+        JsonObject measure = measures.createNestedObject();
+        measure["sensor"] = entry.sensor;
+        measure["channel"] = entry.channel;
+        measure["value"] = entry.value;
+        measure["timestamp"] = epoch - (time_t)(age / 1000);
+        measure["age"] = age;
+        measure["stale"] = age > stale;
+    }
+
+    String JSON;
+    serializeJson(doc, JSON);
+    request->send(200, "application/json", JSON);
+}
+
+#ifdef PORTAL_EMBEDDED
+// Embedded portal asset, gzipped from PROGMEM with its strong ETag. The page is revalidated
+// on every load (304 if unchanged), the assets it refers to are versioned (?v=<hash>) so they
+// are cached for a year.
+static void sendAsset(AsyncWebServerRequest *request, const PortalAsset &asset)
+{
+    const char *cacheControl = strcmp(asset.path, "/") == 0 ? "no-cache" : "public, max-age=31536000, immutable";
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag)
+    {
+        response = request->beginResponse(304);
+    }
+    else
+    {
+        response = request->beginResponse_P(200, asset.type, asset.data, asset.size);
+        response->addHeader("Content-Encoding", "gzip");
+    }
+
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Cache-Control", cacheControl);
+    request->send(response);
+}
+#endif
+
+// Web portal page. The /index.html on LittleFS overrides the portal embedded in the firmware:
+// change the (gzipped) index.html.gz file name to index.html and upload it to ESP. This will work
+// on both chrome and Safari (.gz file name won't work on Safari!).
+void EspClient::_setupAssets()
+{
+    _webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
+                  {
+    Serial.println("Homepage request");
+    if (LittleFS.exists("/index.html"))
+    {
+        AsyncWebServerResponse *response = request->beginResponse(LittleFS, "/index.html", "text/html", false);
+        response->addHeader("Content-Encoding", "gzip");
+        request->send(response);
+        return;
+    }
+
+#ifdef PORTAL_EMBEDDED
+    sendAsset(request, PORTAL_ASSETS[0]);
+#else
+    request->send(404, "text/plain", "No portal, upload index.html");
+#endif
+    });
+
+#ifdef PORTAL_EMBEDDED
+    for (const PortalAsset &asset : PORTAL_ASSETS)
+    {
+        if (strcmp(asset.path, "/") == 0)
+            continue;
+
+        const PortalAsset *pAsset = &asset;
+        _webServer.on(asset.path, HTTP_GET, [pAsset](AsyncWebServerRequest *request)
+                      { sendAsset(request, *pAsset); });
+    }
+
+    Serial.println(F("Portal embedded: " PORTAL_HASH));
+#endif
+}
+
+#ifdef LFS_NAME_MAX
+#define FILE_NAME_MAX LFS_NAME_MAX // LittleFS file name limit
+#else
+#define FILE_NAME_MAX 64
+#endif
+
+// Streaming state of the file list, one piece of JSON is formatted at a time
+struct FileListState
+{
+#ifdef ESP8266
+    Dir dir;
+#elif defined(ESP32)
+    File root;
+#endif
+    int stage = 0; // 0: header, 1: files, 2: disk info, 3: done
+    bool first = true;
+    char piece[2 * FILE_NAME_MAX + 40]; // formatted piece pending: an escaped name with ,{"name":"","size":4294967295}
+    size_t length = 0;
+    size_t sent = 0;
+};
+
+// Copy a string into a JSON string body, quote and backslash escaped. Its length, -1 if it does not fit
+static int jsonEscape(char *out, size_t size, const char *in)
+{
+    size_t n = 0;
+    for (; *in != '\0'; in++)
+    {
+        bool escape = *in == '"' || *in == '\\';
+        if ((uint8_t)*in < 0x20 || n + escape + 1 >= size) // no control characters in a file name
+            return -1;
+
+        if (escape)
+            out[n++] = '\\';
+        out[n++] = *in;
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+// Format the next piece of the file list, false once done
+static bool nextFileListPiece(FileListState &state)
+{
+    state.length = 0;
+    state.sent = 0;
+
+    while (state.length == 0)
+    {
+        switch (state.stage)
+        {
+        case 0:
+            state.length = snprintf(state.piece, sizeof(state.piece), "{\"files\":[");
+            state.stage++;
+            break;
+
+        case 1:
+        {
+            // get file listing on root folder (TODO: Can be extended to subfolders too)
+            String name;
+            size_t size;
+#ifdef ESP8266
+            if (!state.dir.next())
+            {
+                state.stage++;
+                continue;
+            }
+            name = state.dir.fileName();
+            size = state.dir.fileSize();
+#elif defined(ESP32)
+            File file = state.root ? state.root.openNextFile() : File();
+            if (!file)
+            {
+                state.stage++;
+                continue;
+            }
+            if (file.isDirectory())
+                continue;
+            name = file.name();
+            size = file.size();
+#endif
+            char escaped[2 * FILE_NAME_MAX + 1];
+            if (jsonEscape(escaped, sizeof(escaped), name.c_str()) < 0)
+            {
+                Serial.printf("File list: %s skipped, name not listable\n", name.c_str());
+                continue;
+            }
+
+            state.length = snprintf(state.piece, sizeof(state.piece), "%s{\"name\":\"%s\",\"size\":%u}",
+                                    state.first ? "" : ",", escaped, size);
+            state.first = false;
+            break;
+        }
+
+        case 2:
+        {
+            // get used and total data
+            size_t used, total;
+#ifdef ESP8266
+            FSInfo fs_info;
+            LittleFS.info(fs_info);
+            used = fs_info.usedBytes;
+            total = fs_info.totalBytes;
+#elif defined(ESP32)
+            used = LittleFS.usedBytes();
+            total = LittleFS.totalBytes();
+#endif
+            state.length = snprintf(state.piece, sizeof(state.piece), "],\"used\":%u,\"max\":%u}", used, total);
+            state.stage++;
+            break;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    state.length = min(state.length, sizeof(state.piece) - 1); // truncated by snprintf
+    return true;
+}
+
+// Reply the LittleFS file list as a chunked response, e.g.,
+// {"files":[{"name":"config.json","size":1290},{"name":"trace.bin","size":1296}],"used":32768,"max":1024000}
+// One entry is formatted at a time from the directory iterator: constant memory whatever the file count.
+void EspClient::_sendFileList(AsyncWebServerRequest *request)
+{
+    std::shared_ptr<FileListState> state = std::make_shared<FileListState>();
+#ifdef ESP8266
+    state->dir = LittleFS.openDir("");
+#elif defined(ESP32)
+    state->root = LittleFS.open("/", "r");
+#endif
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [state](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+        {
+            size_t n = 0;
+            while (n < maxLen)
+            {
+                if (state->sent >= state->length && !nextFileListPiece(*state))
+                    break;
+
+                size_t k = min(maxLen - n, state->length - state->sent);
+                memcpy(buffer + n, state->piece + state->sent, k);
+                state->sent += k;
+                n += k;
+            }
+            return n;
+        });
+    request->send(response);
+}
+
+// Upload state of a request, kept in request->_tempObject (freed with the request)
+struct UploadState
+{
+    bool ok;                       // all the files of the request stored
+    const char *error;             // request rejected (400), NULL if not
+    bool expectCrc;                // X-CRC32 header given
+    uint32_t expected;             // X-CRC32 of the file
+    uint16_t files;                // files started in the request
+    uint32_t crc;                  // of the current file so far
+    size_t fill;                   // bytes in the buffer
+    char path[FILE_NAME_MAX + 2];  // destination of the current file
+    char tmp[32];                  // temp file written, empty if none
+    uint8_t buf[UPLOAD_BUFFER];
+};
+
+// Stream an uploaded file into a temp file with page aligned writes, and rename it on success.
+// The CRC-32 of the content is checked against the X-CRC32 header (hex) if given, the request
+// then carries one file only.
+void EspClient::_upload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
+{
+    UploadState *state = (UploadState *)request->_tempObject;
+    if (state == NULL)
+    {
+        state = (UploadState *)malloc(sizeof(UploadState));
+        request->_tempObject = state;
+        if (state == NULL)
+            return;
+
+        memset(state, 0, sizeof(UploadState));
+        state->ok = true;
+        state->expectCrc = request->hasHeader("X-CRC32");
+        if (state->expectCrc)
+            state->expected = strtoul(request->getHeader("X-CRC32")->value().c_str(), NULL, 16);
+
+        // remove the partial temp file if the client goes away
+        request->onDisconnect([request]()
+                              {
+            UploadState *state = (UploadState *)request->_tempObject;
+            if (state != NULL && state->tmp[0] != '\0')
+            {
+                request->_tempFile.close();
+                LittleFS.remove(state->tmp);
+            } });
+    }
+
+    if (index == 0)
+    {
+        Serial.println(PSTR("Start file upload"));
+        Serial.println(filename);
+
+        state->tmp[0] = '\0';
+        if (++state->files > 1 && state->expectCrc)
+            state->error = "X-CRC32 checks one file, upload one per request";
+        else if (snprintf(state->path, sizeof(state->path), "%s%s", filename.startsWith("/") ? "" : "/", filename.c_str()) >= (int)sizeof(state->path))
+            state->error = "File name too long";
+
+        if (state->error != NULL)
+        {
+            Serial.printf("Upload rejected: %s\n", state->error);
+            state->ok = false;
+            return;
+        }
+
+        static uint16_t seq = 0;
+        snprintf(state->tmp, sizeof(state->tmp), "/.up%u.tmp", ++seq);
+        state->crc = 0;
+        state->fill = 0;
+        request->_tempFile = LittleFS.open(state->tmp, "w");
+        if (!request->_tempFile)
+            state->tmp[0] = '\0';
+    }
+
+    if (state->tmp[0] == '\0')
+    {
+        state->ok = false;
+        return;
+    }
+
+    state->crc = crc32Update(state->crc, data, len);
+
+    // fill the buffer, write it out when full
+    while (len > 0)
+    {
+        size_t n = min(len, (size_t)UPLOAD_BUFFER - state->fill);
+        memcpy(state->buf + state->fill, data, n);
+        state->fill += n;
+        data += n;
+        len -= n;
+
+        if (state->fill == UPLOAD_BUFFER)
+        {
+            if (request->_tempFile.write(state->buf, state->fill) != state->fill)
+                state->ok = false;
+            state->fill = 0;
+        }
+    }
+
+    if (!final)
+        return;
+
+    if (state->fill > 0 && request->_tempFile.write(state->buf, state->fill) != state->fill)
+        state->ok = false;
+
+    request->_tempFile.close();
+
+    bool ok = state->ok && (!state->expectCrc || state->crc == state->expected);
+    if (ok)
+    {
+        // Delete existing file, rename does not overwrite on LittleFS
+        if (LittleFS.exists(state->path))
+            LittleFS.remove(state->path);
+        ok = LittleFS.rename(state->tmp, state->path);
+    }
+
+    if (!ok)
+    {
+        Serial.printf("Upload failed: %s, crc %08x\n", state->path, state->crc);
+        LittleFS.remove(state->tmp);
+        state->ok = false;
+    }
+
+    state->tmp[0] = '\0';
+}
+
+// Reply once the whole request is received, e.g., {"success":true,"crc":"8a9136aa"}
+void EspClient::_endUpload(AsyncWebServerRequest *request)
+{
+    UploadState *state = (UploadState *)request->_tempObject;
+    bool ok = state != NULL && state->ok;
+
+    if (state != NULL && state->error != NULL)
+    {
+        request->send(400, "text/plain", state->error);
+        return;
+    }
+
+    char JSON[50];
+    snprintf(JSON, sizeof(JSON), "{\"success\":%s,\"crc\":\"%08x\"}", ok ? "true" : "false", state != NULL ? state->crc : 0);
+    request->send(ok ? 200 : 422, "application/json", JSON);
+}
+
+// Heavy portal requests are paused by the low-memory governor
+bool EspClient::_lowMemory(AsyncWebServerRequest *request)
+{
+    if (memGuard.level() < ML_Pause)
+        return false;
+
+    AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Low memory, try again later");
+    response->addHeader("Retry-After", "30");
+    request->send(response);
+    return true;
+}
+
+// Metrics in Prometheus text exposition format, durations in us
+void EspClient::_sendMetrics(AsyncWebServerRequest *request)
+{
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+    char labels[40];
+
+    Metrics::writeType(*response, "esp_loop_us", "histogram");
+    Metrics::writeHistogram(*response, "esp_loop_us", NULL, metrics.loop);
+
+    Metrics::writeType(*response, "esp_resolve_us", "histogram");
+    Metrics::writeHistogram(*response, "esp_resolve_us", NULL, metrics.resolve);
+
+    Metrics::writeType(*response, "esp_action_us", "histogram");
+    for (size_t i = 0; i < sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]); i++)
+    {
+        snprintf(labels, sizeof(labels), "action=\"%s\"", ACTION_NAMES[i]);
+        Metrics::writeHistogram(*response, "esp_action_us", labels, metrics.action[i]);
+    }
+
+    Metrics::writeType(*response, "esp_read_us", "histogram");
+    for (Sensor *pSensor : _sensors)
+    {
+        if (pSensor == NULL)
+            continue;
+        snprintf(labels, sizeof(labels), "sensor=\"%s\"", pSensor->name);
+        Metrics::writeHistogram(*response, "esp_read_us", labels, pSensor->readTime);
+    }
+
+    Metrics::writeType(*response, "esp_read_errors_total", "counter");
+    for (Sensor *pSensor : _sensors)
+    {
+        if (pSensor == NULL)
+            continue;
+        snprintf(labels, sizeof(labels), "sensor=\"%s\"", pSensor->name);
+        Metrics::writeCounter(*response, "esp_read_errors_total", labels, pSensor->readErrors);
+    }
+
+    static const char *const PRI_NAMES[] = {"alarm", "measure", "status", "replay"};
+    const char *names[] = {"esp_mqtt_published_total", "esp_mqtt_dropped_total", "esp_mqtt_bytes_total"};
+    const uint32_t *values[] = {mqttQueue.published, mqttQueue.dropped, mqttQueue.bytes};
+    for (int k = 0; k < 3; k++)
+    {
+        Metrics::writeType(*response, names[k], "counter");
+        for (int i = 0; i < PRI_COUNT; i++)
+        {
+            snprintf(labels, sizeof(labels), "pri=\"%s\"", PRI_NAMES[i]);
+            Metrics::writeCounter(*response, names[k], labels, values[k][i]);
+        }
+    }
+
+    Metrics::writeType(*response, "esp_mqtt_queue", "gauge");
+    Metrics::writeGauge(*response, "esp_mqtt_queue", NULL, mqttQueue.size());
+    Metrics::writeType(*response, "esp_mqtt_held", "gauge");
+    Metrics::writeGauge(*response, "esp_mqtt_held", NULL, mqttQueue.held());
+    Metrics::writeType(*response, "esp_mqtt_restamped_total", "counter");
+    Metrics::writeCounter(*response, "esp_mqtt_restamped_total", NULL, mqttQueue.restamped);
+
+    Metrics::writeType(*response, "esp_wifi_connects_total", "counter");
+    Metrics::writeCounter(*response, "esp_wifi_connects_total", NULL, metrics.wifiConnects);
+    Metrics::writeType(*response, "esp_wifi_disconnects_total", "counter");
+    Metrics::writeCounter(*response, "esp_wifi_disconnects_total", NULL, metrics.wifiDisconnects);
+    Metrics::writeType(*response, "esp_mqtt_tries_total", "counter");
+    Metrics::writeCounter(*response, "esp_mqtt_tries_total", NULL, metrics.mqttTries);
+    Metrics::writeType(*response, "esp_mqtt_connects_total", "counter");
+    Metrics::writeCounter(*response, "esp_mqtt_connects_total", NULL, metrics.mqttConnects);
+    Metrics::writeType(*response, "esp_mqtt_disconnects_total", "counter");
+    Metrics::writeCounter(*response, "esp_mqtt_disconnects_total", NULL, metrics.mqttDisconnects);
+#ifdef MQTT_TLS
+    Metrics::writeType(*response, "esp_tls_handshake_us", "histogram");
+    Metrics::writeHistogram(*response, "esp_tls_handshake_us", "session=\"full\"", mqttClient.fullHandshake);
+    Metrics::writeHistogram(*response, "esp_tls_handshake_us", "session=\"resumed\"", mqttClient.resumedHandshake);
+    Metrics::writeType(*response, "esp_tls_errors_total", "counter");
+    Metrics::writeCounter(*response, "esp_tls_errors_total", NULL, mqttClient.tlsErrors);
+#endif
+    Metrics::writeType(*response, "esp_resolve_lookups_total", "counter");
+    Metrics::writeCounter(*response, "esp_resolve_lookups_total", NULL, resolver.lookups);
+    Metrics::writeType(*response, "esp_resolve_failures_total", "counter");
+    Metrics::writeCounter(*response, "esp_resolve_failures_total", NULL, resolver.failures);
+    Metrics::writeType(*response, "esp_resolve_changes_total", "counter");
+    Metrics::writeCounter(*response, "esp_resolve_changes_total", NULL, resolver.changes);
+
+    uint32_t free, block, frag;
+    MemGuard::heapInfo(free, block, frag);
+    Metrics::writeType(*response, "esp_heap_free_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_heap_free_bytes", NULL, free);
+    Metrics::writeType(*response, "esp_heap_max_block_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_heap_max_block_bytes", NULL, block);
+    Metrics::writeType(*response, "esp_heap_fragmentation_percent", "gauge");
+    Metrics::writeGauge(*response, "esp_heap_fragmentation_percent", NULL, frag);
+    Metrics::writeType(*response, "esp_heap_min_free_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_heap_min_free_bytes", NULL, memGuard.minFree);
+    Metrics::writeType(*response, "esp_heap_min_block_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_heap_min_block_bytes", NULL, memGuard.minBlock);
+    Metrics::writeType(*response, "esp_mem_level", "gauge");
+    Metrics::writeGauge(*response, "esp_mem_level", NULL, memGuard.level());
+    Metrics::writeType(*response, "esp_mem_level_changes_total", "counter");
+    Metrics::writeCounter(*response, "esp_mem_level_changes_total", NULL, memGuard.changes);
+    Metrics::writeType(*response, "esp_mem_restarts", "gauge");
+    Metrics::writeGauge(*response, "esp_mem_restarts", NULL, memGuard.saved.restarts);
+    Metrics::writeType(*response, "esp_ota_received_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_ota_received_bytes", NULL, otaUpdate.next());
+    Metrics::writeType(*response, "esp_ota_size_bytes", "gauge");
+    Metrics::writeGauge(*response, "esp_ota_size_bytes", NULL, otaUpdate.size());
+    Metrics::writeType(*response, "esp_ota_chunks_total", "counter");
+    Metrics::writeCounter(*response, "esp_ota_chunks_total", NULL, otaUpdate.chunks);
+    Metrics::writeType(*response, "esp_ota_rejected_total", "counter");
+    Metrics::writeCounter(*response, "esp_ota_rejected_total", NULL, otaUpdate.rejected);
+    Metrics::writeType(*response, "esp_uptime_seconds", "gauge");
+    Metrics::writeGauge(*response, "esp_uptime_seconds", NULL, millis() / 1000);
+
+    request->send(response);
+}
+
+// Compact diagnostic on <module>/diag, e.g.,
+// {"up":3600,"heap":21000,"block":18000,"frag":12,"min":15000,"mem":0,"loop":{"n":912345,"avg":180,"max":35000},
+//  "pub":1800,"drop":0,"bytes":90000,"q":0,"wifi":1,"mqtt":1,"read":3}
+// Also sent when the memory level changes.
+void EspClient::_sendDiag()
+{
+    uint32_t published = 0, dropped = 0, bytes = 0;
+    for (int i = 0; i < PRI_COUNT; i++)
+    {
+        published += mqttQueue.published[i];
+        dropped += mqttQueue.dropped[i];
+        bytes += mqttQueue.bytes[i];
+    }
+
+    uint32_t readErrors = 0;
+    for (Sensor *pSensor : _sensors)
+    {
+        if (pSensor != NULL)
+            readErrors += pSensor->readErrors;
+    }
+
+    uint32_t free, block, frag;
+    MemGuard::heapInfo(free, block, frag);
+
+    char payload[MQTT_PAYLOAD_LEN];
+    snprintf(payload, sizeof(payload),
+             "{\"up\":%lu,\"heap\":%lu,\"block\":%lu,\"frag\":%lu,\"min\":%lu,\"mem\":%d,\"loop\":{\"n\":%lu,\"avg\":%lu,\"max\":%lu},"
+             "\"pub\":%lu,\"drop\":%lu,\"bytes\":%lu,\"q\":%u,\"wifi\":%lu,\"mqtt\":%lu,\"read\":%lu}",
+             millis() / 1000, free, block, frag, memGuard.minFree, memGuard.level(), metrics.loop.count, metrics.loop.mean(), metrics.loop.max,
+             published, dropped, bytes, mqttQueue.size(), metrics.wifiConnects, metrics.mqttConnects, readErrors);
+
+    static String topic = cfg.module + MQTT_PUB_DIAG;
+    mqttQueue.push(topic.c_str(), payload, PRI_STATUS);
+}
+
+// Reset reason name, as ESP.getResetReason() of the ESP8266 core
+static const char *resetReason()
+{
+#ifdef ESP8266
+    static String reason = ESP.getResetReason();
+    return reason.c_str();
+#elif defined(ESP32)
+    switch (esp_reset_reason())
+    {
+    case ESP_RST_POWERON:
+        return "Power On";
+    case ESP_RST_EXT:
+        return "External System";
+    case ESP_RST_SW:
+        return "Software/System restart";
+    case ESP_RST_PANIC:
+        return "Exception";
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+        return "Watchdog";
+    case ESP_RST_DEEPSLEEP:
+        return "Deep-Sleep Wake";
+    case ESP_RST_BROWNOUT:
+        return "Brownout";
+    case ESP_RST_SDIO:
+        return "SDIO";
+    default:
+        return "Unknown";
+    }
+#endif
+}
+
+// Boot timeline (ms since power up) as a retained message on <module>/boot, e.g.,
+// {"reset":"Power On","start":95,"config":160,"portal":210,"wifi":215,"ota":230,"mqtt":231,"join":3300,
+//  "sensors":3520,"setup":3521,"ip":3290,"dns":3450,"conn":4610,"ntp":5240,"tries":1}
+// Analyzed fleet-wide with tools/boot_report.py
+void EspClient::_sendBootReport()
+{
+    const BootReport &boot = metrics.boot;
+
+    char payload[MQTT_PAYLOAD_LEN];
+    snprintf(payload, sizeof(payload),
+             "{\"reset\":\"%s\",\"start\":%lu,\"config\":%lu,\"portal\":%lu,\"wifi\":%lu,\"ota\":%lu,\"mqtt\":%lu,"
+             "\"join\":%lu,\"sensors\":%lu,\"setup\":%lu,\"ip\":%lu,\"dns\":%lu,\"conn\":%lu,\"ntp\":%lu,\"tries\":%lu}",
+             resetReason(), boot.start, boot.config, boot.portal, boot.wifi, boot.ota, boot.mqtt,
+             boot.join, boot.sensors, boot.setup, boot.gotIp, boot.resolved, boot.mqttConn, boot.ntp, metrics.mqttTries);
+
+    static String topic = cfg.module + MQTT_PUB_BOOT;
+    if (mqttQueue.push(topic.c_str(), payload, PRI_STATUS, 1, true))
+        metrics.boot.sent = true;
+
+    Serial.printf("%s: %s\n", topic.c_str(), payload);
+}
+
+// Send the trace dump on <module>/trace as consecutive binary chunks (qos 1, in order), so the
+// concatenated payloads are the dump, e.g.,
+// mosquitto_sub -h raspberrypi -t OilGauge/trace -N > trace.bin
+// A chunk is pushed only when the queue has room, measures and alarms go first.
+void EspClient::_sendTrace()
+{
+    // deferred until the heap recovers
+    if (memGuard.level() >= ML_Defer)
+        return;
+
+    if (_traceDump == NULL)
+    {
+        _traceSize = trace.dumpSize();
+        _traceDump = (uint8_t *)malloc(_traceSize);
+        if (_traceDump == NULL)
+        {
+            jTimer.getTimer(ACT_CMD_TRACE)->enable = false;
+            return;
+        }
+
+        _traceSize = trace.dump(_traceDump, _traceSize);
+        _traceSent = 0;
+    }
+
+    if (_mqttConnected && mqttQueue.size() < MQTT_QUEUE_SIZE / 2)
+    {
+        static String topic = cfg.module + MQTT_PUB_TRACE;
+        size_t n = min(memGuard.batch(MQTT_PAYLOAD_LEN), _traceSize - _traceSent);
+        if (mqttQueue.push(topic.c_str(), (const char *)_traceDump + _traceSent, PRI_REPLAY, 1, false, n))
+            _traceSent += n;
+    }
+
+    if (_traceSent >= _traceSize)
+    {
+        free(_traceDump);
+        _traceDump = NULL;
+        jTimer.getTimer(ACT_CMD_TRACE)->enable = false;
+    }
+}
+
+// Start a profile run, payload "<seconds>,<mode>", e.g., "10,pc" or "30,tag"
+void EspClient::_startProfile(const char *payload)
+{
+    if (profiler.mode() != PM_Off || _profileNext >= 0)
+    {
+        Serial.println(F("Profiler busy"));
+        return;
+    }
+
+    int secs = constrain(atoi(payload), 1, PROFILE_MAX_SECS);
+    const char *comma = strchr(payload, ',');
+    ProfileMode mode = (comma != NULL && strcmp(comma + 1, "tag") == 0) ? PM_Tag : PM_PC;
+
+    if (!profiler.start(mode))
+    {
+        Serial.println(F("Profiler: mode not supported"));
+        return;
+    }
+
+    jTimer.setTimer(this, ACT_CMD_PROFILE, secs * 1000);
+    Serial.printf("Profiler: %s for %ds\n", mode == PM_PC ? "pc" : "tag", secs);
+}
+
+// Report entry, "<pc>":<samples> in pc mode, "<tag>":[<count>,<us>] in tag mode
+bool EspClient::_profileEntry(int index, char *buf, size_t size)
+{
+    if (index >= _profileCount)
+        return false;
+
+    if (profiler.lastMode() == PM_PC)
+    {
+        // pc mode, the slots are sorted by count
+        const Profiler::Slot &slot = profiler.slot(index);
+        snprintf(buf, size, "\"%08x\":%lu", slot.pc, slot.count);
+        return true;
+    }
+
+    // tag mode: index-th tag used
+    for (int i = 0; i < PROFILE_TAGS; i++)
+    {
+        const Profiler::Tag &tag = profiler.tagAt(i);
+        if (tag.count == 0 || index-- > 0)
+            continue;
+
+        char name[30];
+        if (i >= PT_LOOP)
         {
-            uint8_t pinTrig = sensor["pins"]["pinTrig"];
-            uint8_t pinEcho = sensor["pins"]["pinEcho"];
-            pSensor = new SR04(name.c_str(), pinTrig, pinEcho);
+            static const char *const LOOP_NAMES[] = {"loop", "loop:timers", "loop:acquire", "loop:drain", "loop:ota"};
+            snprintf(name, sizeof(name), "%s", i - PT_LOOP < 5 ? LOOP_NAMES[i - PT_LOOP] : "?");
         }
-        else if (type == "VL53L0X")
+        else if (i >= PT_SENSOR)
         {
-            pSensor = new VL53L0X(name.c_str());
+            int id = i - PT_SENSOR;
+            snprintf(name, sizeof(name), "read:%s", id < (int)_sensors.size() && _sensors[id] != NULL ? _sensors[id]->name : "?");
         }
-        else if (type == "DHT11")
+        else
         {
-            uint8_t pinData = sensor["pins"]["pinData"];
-            pSensor = new DH11(name.c_str(), pinData);
+            snprintf(name, sizeof(name), "%s", i < (int)(sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0])) ? ACTION_NAMES[i] : "?");
         }
 
-        if (pSensor != NULL)
+        snprintf(buf, size, "\"%s\":[%lu,%llu]", name, tag.count, tag.us);
+        return true;
+    }
+
+    return false;
+}
+
+// Profile report on <module>/profile in parts of the same run, the last one has "last":true, e.g.,
+// {"run":2,"part":0,"mode":"pc","secs":10.0,"samples":9990,"lost":0,"hz":1000,"pc":{"40201230":812,"4020a4f0":640}}
+// {"run":2,"part":1,"pc":{"40100c80":93},"last":true}
+// Symbolized on the host by tools/profile_symbolize.py. Tag mode reports "tag":{"<tag>":[<count>,<us>]} instead.
+void EspClient::_sendProfile()
+{
+    bool pcMode = profiler.lastMode() == PM_PC;
+
+    if (_profileNext < 0)
+    {
+        // end of the run
+        profiler.stop();
+
+        if (pcMode)
         {
-            String mqtt_pub_sensor = cfg.module + "/sensor/" + name;
-            pSensor->setMqtt(&mqttClient, mqtt_pub_sensor.c_str(), 0, false);
-            Serial.print(F("Sensor init: "));
-            Serial.println(name);
+            _profileCount = min(profiler.sortSlots(), PROFILE_REPORT);
         }
         else
         {
-            Serial.print(F("Invalide sensor type: "));
-            Serial.println(type);
+            _profileCount = 0;
+            for (int i = 0; i < PROFILE_TAGS; i++)
+            {
+                if (profiler.tagAt(i).count > 0)
+                    _profileCount++;
+            }
         }
 
-        _sensors.push_back(pSensor);
+        _profileNext = 0;
+        _profilePart = 0;
+        jTimer.setInterval(this, ACT_CMD_PROFILE, 100); // send the parts
+        return;
     }
-}
 
-void EspClient::loop()
-{
-    // let JTimer do it's magic every time loop() is executed
-    jTimer.run();
+    if (!_mqttConnected || mqttQueue.size() >= MQTT_QUEUE_SIZE / 2 || memGuard.level() >= ML_Defer)
+        return;
 
-    ArduinoOTA.handle(); // Listen for and handle OTA firmware upload requests.
+    char payload[MQTT_PAYLOAD_LEN];
+    int n = snprintf(payload, sizeof(payload), "{\"run\":%u,\"part\":%d,", profiler.run, _profilePart);
+    if (_profilePart == 0)
+        n += snprintf(payload + n, sizeof(payload) - n, "\"mode\":\"%s\",\"secs\":%.1f,\"samples\":%lu,\"lost\":%lu,\"hz\":%d,",
+                      pcMode ? "pc" : "tag", profiler.duration / 1000.0, profiler.samples, profiler.lost, PROFILE_HZ);
+    n += snprintf(payload + n, sizeof(payload) - n, "\"%s\":{", pcMode ? "pc" : "tag");
+
+    // as many entries as fit, keeping room for the closing "},"last":true}"
+    char entry[60];
+    int next = _profileNext;
+    bool first = true;
+    while (_profileEntry(next, entry, sizeof(entry)) && n + strlen(entry) + 20 < sizeof(payload))
+    {
+        n += snprintf(payload + n, sizeof(payload) - n, "%s%s", first ? "" : ",", entry);
+        first = false;
+        next++;
+    }
+
+    bool last = next >= _profileCount;
+    snprintf(payload + n, sizeof(payload) - n, last ? "},\"last\":true}" : "}}");
+
+    static String topic = cfg.module + MQTT_PUB_PROFILE;
+    if (!mqttQueue.push(topic.c_str(), payload, PRI_REPLAY, 1, false))
+        return; // retry the same part on the next tick
+
+    _profileNext = next;
+    _profilePart++;
+    if (last)
+    {
+        _profileNext = -1;
+        profiler.release();
+        jTimer.getTimer(ACT_CMD_PROFILE)->enable = false;
+    }
 }
 
 // Initiate a Wifi connection
@@ -166,12 +1193,9 @@ void EspClient::_connectToWifi()
 #endif
 
         WiFi.begin(cfg.ssid.c_str(), cfg.pass.c_str());
-        while (WiFi.status() != WL_CONNECTED)
-        {
-            loop();
-            Serial.print(WiFi.status());
-            delay(1000);
-        }
+
+        // not blocking, the got IP event moves on to MQTT
+        _setConnState(CS_Wifi, WIFI_CONNECTING_TIMEOUT + _wifiBackoff.next());
     }
 
 #ifdef ESP8266
@@ -179,12 +1203,109 @@ void EspClient::_connectToWifi()
 #endif
 }
 
+void EspClient::_setConnState(ConnState state, uint32_t delay)
+{
+    _connState = state;
+    TRACE(EV_CONNECT, state, delay);
+
+    if (state != CS_Online)
+    {
+        jTimer.setTimer(this, ACT_CONNECT, delay);
+    }
+    else
+    {
+        Timer *pTimer = jTimer.getTimer(ACT_CONNECT);
+        if (pTimer != NULL)
+            pTimer->enable = false;
+    }
+}
+
+// Attempt of the current stage, and the retry in case no event moves the state on
+void EspClient::_connectStep()
+{
+    switch (_connState)
+    {
+    case CS_Wifi:
+        if (WiFi.status() == WL_CONNECTED)
+            break; // the got IP event is on its way
+
+        Serial.println(F("WiFi: Rejoin"));
+        WiFi.begin(cfg.ssid.c_str(), cfg.pass.c_str());
+        _setConnState(CS_Wifi, WIFI_CONNECTING_TIMEOUT + _wifiBackoff.next());
+        break;
+
+    case CS_Resolve:
+    {
+        // connect as soon as the lookup answers
+        LookupState state = resolver.poll();
+        if (resolver.hasAddress())
+        {
+            _resolveBackoff.clear();
+            _setConnState(CS_Mqtt, 0);
+        }
+        else if (state == LS_Failed)
+        {
+            _setConnState(CS_Resolve, _resolveBackoff.next());
+        }
+        else
+        {
+            resolver.lookup(); // unless pending
+            jTimer.setTimer(this, ACT_CONNECT, RESOLVE_POLL);
+        }
+        break;
+    }
+
+    case CS_Mqtt:
+        // a failed attempt is retried by the timer, the disconnect event only handles a lost connection
+        if (_wifiConnected && !_mqttConnected)
+        {
+            // the previous attempt failed, or the cached address is old: look the name up again in
+            // the background, the next attempt goes to the new address
+            if (_mqttBackoff.attempts() > 1 || resolver.expired())
+                resolver.lookup();
+            _connectToMqttBroker();
+        }
+        _setConnState(CS_Mqtt, _mqttBackoff.next());
+        break;
+
+    case CS_Subscribe:
+        // check mqtt connection before subscribe. MQTT broker disconnection can happen!
+        if (_mqttConnected)
+        {
+            String module = String(cfg.module);
+            // module.toLowerCase();
+            auto cmdTopic = module + "/cmd/#";
+
+            Serial.print(F("Subscribe command topic: "));
+            Serial.println(cmdTopic);
+
+            // subscribe command topics, online once acknowledged
+            mqttClient.subscribe(cmdTopic.c_str(), 2);
+        }
+        _setConnState(CS_Subscribe, _subscribeBackoff.next());
+        break;
+
+    case CS_Online:
+        break;
+    }
+}
+
 // Try to connect to the MQTT broker and return True if the connection is successfull (blocking)
 void EspClient::_connectToMqttBroker()
 {
+    metrics.mqttTries++;
+    TRACE(EV_MQTT_TRY, metrics.mqttTries);
+
+    // cached address first, the client resolves the name itself only if none is known
+    if (resolver.hasAddress())
+    {
+        mqttClient.setServer(resolver.address(), cfg.mqttPort);
+        if (metrics.boot.resolved == 0)
+            metrics.boot.resolved = BootReport::now();
+    }
+
     mqttClient.connect();
-    Serial.print(F("MQTT: Connecting "));
-    Serial.println(cfg.mqttServer.c_str());
+    Serial.printf("MQTT: Connecting %s (%s)\n", cfg.mqttServer.c_str(), resolver.address().toString().c_str());
 }
 
 void EspClient::_setupWifi()
@@ -239,16 +1360,20 @@ void EspClient::_setupWifi()
             if (!_wifiConnected) // just got disconnected
             {
                 _wifiConnected = true;
+                metrics.wifiConnects++;
+                if (metrics.boot.gotIp == 0)
+                    metrics.boot.gotIp = BootReport::now();
+
+                IPAddress ip = WiFi.localIP();
+                TRACE(EV_WIFI_UP, ip[0], ip[1], ip[2], ip[3]);
 
                 // Set NTP sync action timer (to be executed in main loop() function)
                 jTimer.setInterval(this, ACT_CMD_SYNC_NTP, 1e3);
 
-                // Set MQTT reconnect action timer
-                jTimer.setTimer(this, ACT_MQTT_RECONNECT, MQTT_RECONNECT_INTERVAL, MQTT_MAX_TRY);
-
-#ifdef _DEBUG
-                Serial.println("MQTT: Set reconnect timmer");
-#endif
+                // Connect MQTT after a random delay, devices that lost the AP together do not connect together.
+                // The broker name is looked up first only if no address is cached.
+                _wifiBackoff.clear();
+                _setConnState(resolver.hasAddress() ? CS_Mqtt : CS_Resolve, _mqttBackoff.next());
 
                 _stopAP(); // The mode will be changed back to to WFIF_STA
             }
@@ -273,8 +1398,17 @@ void EspClient::_setupWifi()
 
             if (_wifiConnected) // just got disconnected
             {
+                metrics.wifiDisconnects++;
+#ifdef ESP8266
+                TRACE(EV_WIFI_DOWN, event.reason);
+#elif defined(ESP32)
+                TRACE(EV_WIFI_DOWN, info.wifi_sta_disconnected.reason);
+#endif
                 _startAP();
                 _wifiConnected = false;
+
+                // auto reconnect is on, rejoin only if it does not come back
+                _setConnState(CS_Wifi, WIFI_CONNECTING_TIMEOUT + _wifiBackoff.next());
             }
         }
 #ifdef ESP8266
@@ -296,14 +1430,15 @@ void EspClient::_setupMQTT()
                          {
     if(!_mqttConnected) // just got connected
     {
-      // set delay action timmer to subscribe command topic
-      jTimer.setTimer(this, ACT_MQTT_SUBSCRIBE, MQTT_SUBSCRIBE_DELAY);
+      // subscribe command topic after a delay
+      _setConnState(CS_Subscribe, MQTT_SUBSCRIBE_DELAY);
 
       // set the flag at the end to make sure there is no other hareware interrup action casusing exception!!
       _mqttConnected = true;
-
-      // disable the reconnect timer as it's been connected
-      jTimer.getTimer(ACT_MQTT_RECONNECT)->enable = false;
+      metrics.mqttConnects++;
+      if (metrics.boot.mqttConn == 0)
+          metrics.boot.mqttConn = BootReport::now();
+      TRACE(EV_MQTT_UP);
 
       _printLine();
       Serial.println(F("MQTT: Connected"));
@@ -319,8 +1454,12 @@ void EspClient::_setupMQTT()
     if(_mqttConnected) // means just turned to disconnect, set reconnet timer
     {
       _mqttConnected = false;
+      metrics.mqttDisconnects++;
+      TRACE(EV_MQTT_DOWN, (uint8_t)reason);
 
-      jTimer.setTimer(this, ACT_MQTT_RECONNECT, MQTT_RECONNECT_INTERVAL, MQTT_MAX_TRY);
+      // reconnect with backoff, unless the Wi-Fi is down too
+      if (_wifiConnected)
+          _setConnState(CS_Mqtt, _mqttBackoff.next());
 
       _printLine();
       Serial.println(F("MQTT: Disconnected"));
@@ -337,6 +1476,13 @@ void EspClient::_setupMQTT()
 #ifdef _DEBUG
                                Serial.printf("Subscribe acknowledged. PacketId: %d, qos: %d\n", packetId, qos);
 #endif
+                               // online: the next connection loss starts the backoffs over
+                               if (_connState == CS_Subscribe)
+                               {
+                                   _mqttBackoff.clear();
+                                   _subscribeBackoff.clear();
+                                   _setConnState(CS_Online, 0);
+                               }
                            });
 
     //-- Set MQTT broker "unsubscribe" event listener/callback function
@@ -383,11 +1529,20 @@ void EspClient::_setupMQTT()
     int size = cfg.module.length();
     _cmdHandler(&(topic[size]), buffer); });
 
-    // set MQTT broker
+    // All outgoing messages go through the priority queue
+    mqttQueue.begin(&mqttClient);
+
+    // set MQTT broker, its address is cached across restarts
     mqttClient.setServer(cfg.mqttServer.c_str(), cfg.mqttPort);
+    resolver.begin(cfg.mqttServer.c_str(), cfg.doc["mqtt"]["ttl"] | RESOLVER_TTL);
 
     // If your broker requires authentication (username and password), set them below
     mqttClient.setCredentials(cfg.mqttUser.c_str(), cfg.mqttPass.c_str());
+
+#ifdef MQTT_TLS
+    // broker authentication: /ca.pem on LittleFS, else the certificate fingerprint of the config
+    mqttClient.setTrust(cfg.doc["mqtt"]["fingerprint"] | "");
+#endif
 }
 
 #ifdef _DEBUG
@@ -499,6 +1654,50 @@ void EspClient::_setupOTA()
     Serial.printf("OTA: %s @ %s\n", cfg.module.c_str(), WiFi.localIP().toString().c_str());
 }
 
+// Resumable, checksummed firmware upload, as done by tools/ota_pack.py:
+// POST /api/ota/begin?size=<bytes>&md5=<hex>      open the session, or resume the one of the same image
+// POST /api/ota/chunk?offset=<n>&crc=<hex>        body: the image bytes at offset (max OTA_CHUNK), CRC-32 checked
+// GET  /api/ota/status                            the next expected offset and the progress
+// POST /api/ota/end                               verify the MD5 and restart into the new firmware
+// Every reply is the session status; a rejected chunk (409) is resent from the "next" offset.
+void EspClient::_setupOtaApi()
+{
+    _webServer.on("/api/ota/begin", HTTP_POST, [](AsyncWebServerRequest *request)
+                  {
+    if (_lowMemory(request))
+        return;
+
+    size_t size = request->hasParam("size") ? request->getParam("size")->value().toInt() : 0;
+    String md5 = request->hasParam("md5") ? request->getParam("md5")->value() : String();
+    _sendOtaStatus(request, otaUpdate.begin(size, md5.c_str()) ? 200 : 422); });
+
+    _webServer.on("/api/ota/chunk", HTTP_POST, [](AsyncWebServerRequest *request)
+                  {
+    size_t offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+    uint32_t crc = request->hasParam("crc") ? strtoul(request->getParam("crc")->value().c_str(), NULL, 16) : 0;
+    _sendOtaStatus(request, otaUpdate.commit(offset, crc) ? 200 : 409); },
+                  NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+                  { otaUpdate.append(index, data, len); });
+
+    _webServer.on("/api/ota/status", HTTP_GET, [](AsyncWebServerRequest *request)
+                  { _sendOtaStatus(request, 200); });
+
+    _webServer.on("/api/ota/end", HTTP_POST, [&](AsyncWebServerRequest *request)
+                  {
+    bool ok = otaUpdate.end();
+    _sendOtaStatus(request, ok ? 200 : 422);
+    if (ok)
+        jTimer.setTimer(this, ACT_CMD_RESTART, 1000); });
+}
+
+void EspClient::_sendOtaStatus(AsyncWebServerRequest *request, int code)
+{
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->setCode(code);
+    otaUpdate.writeStatus(*response);
+    request->send(response);
+}
+
 // This will start a webserver allowing user to configure all settings via this web portal.
 // Two approach to access the webserver:
 //     1. Connect AP WiFi SSID (usually named "ESP-XXXX"). Browse 192.168.4.1
@@ -507,26 +1706,18 @@ void EspClient::_setupOTA()
 //     2. Connect via Family network. Only works when the module is still connected
 //        to the family Wifi router with a valid ip address.
 // parameter: force means force open the portal (even there is no connection issue)
-void EspClient::setupPortal(bool blocking) // char const *apName, char const *apPassword)
+void EspClient::setupPortal() // char const *apName, char const *apPassword)
 {
 #ifdef _DEBUG
     Serial.println(F("setupPortal()"));
 #endif
 
-    _portalOn = true;         // this will enable the pollPortal call in the loop of main.cpp
-    _portalSubmitted = false; // used when portal is in blocking mode. will be set to true when the configuration is done in _handleConfigPortal
+    _portalOn = true; // this will enable the pollPortal call in the loop of main.cpp
 
     // -- setup web handlers ------------------------------
 
-    // Route for root / web portal page - index.html
-    // change the (gzipped) index.html.gz file name to index.html and upload it to ESP. This will work
-    // on both chrome and Safari (.gz file name won't work on Safari!).
-    _webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
-                  {
-    Serial.println("Homepage request");
-    AsyncWebServerResponse *response = request->beginResponse(LittleFS, "/index.html", "text/html", false);
-    response->addHeader("Content-Encoding", "gzip");
-    request->send(response); });
+    // Route for root / web portal page, and its assets
+    _setupAssets();
 
     _webServer.on("/restart", HTTP_GET, [&](AsyncWebServerRequest *request)
                   {
@@ -537,91 +1728,15 @@ void EspClient::setupPortal(bool blocking) // char const *apName, char const *ap
     _webServer.on(PSTR("/api/files/list"), HTTP_GET, [](AsyncWebServerRequest *request)
                   {
     Serial.println("Got list");
-
-    String JSON;
-    StaticJsonDocument<1000> jsonBuffer;
-    JsonArray jsFiles = jsonBuffer.createNestedArray("files");
-
-        // get file listing on root folder (TODO: Can be extended to subfolders too)
-#ifdef ESP8266
-    Dir dir = LittleFS.openDir("");
-    while (dir.next())
-    {
-      JsonObject jsFile = jsFiles.createNestedObject();
-      jsFile["name"] = dir.fileName();
-      jsFile["size"] = dir.fileSize();
-      // files.add(dir.fileName()); //.substring(1));
-    }
-
-    //get used and total data
-    FSInfo fs_info;
-    LittleFS.info(fs_info);
-    jsonBuffer["used"] = fs_info.usedBytes;
-    jsonBuffer["max"] = fs_info.totalBytes;
-#elif defined(ESP32)    
-    File root = LittleFS.open("/", "r");
-    if(root && root.isDirectory())
-    {
-      File file = root.openNextFile();
-      while (file)
-      {
-        if(!file.isDirectory())
-        {
-          JsonObject jsFile = jsFiles.createNestedObject();
-          jsFile["name"] = file.name();
-          jsFile["size"] = file.size();
-          // files.add(file.name()); //.substring(1));
-        }
-
-        file = root.openNextFile();
-      }
-    }
-
-    // ESP32 FS does not have interface defined to get FSInfo!!
-    jsonBuffer["used"] = 1;
-    jsonBuffer["max"] = 1;
-#endif
-
-    serializeJson(jsonBuffer, JSON);
-    Serial.println(JSON);
-    request->send(200, PSTR("text/html"), JSON); });
+    if (!_lowMemory(request))
+        _sendFileList(request); });
 
     //-- Handle file upload request
-    _webServer.on(PSTR("/api/files/upload"), HTTP_POST, [](AsyncWebServerRequest *request) {}, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
-                  {
-
-    static File fsUploadFile;
-
-    if (!index)
-    {
-        Serial.println(PSTR("Start file upload"));
-        Serial.println(filename);
-
-        if (!filename.startsWith("/"))
-            filename = "/" + filename;
-
-        // Delete existing file, otherwise it will be appended to the end of the existing file
-        if(LittleFS.exists(filename)) LittleFS.remove(filename);
-
-        fsUploadFile = LittleFS.open(filename, "w");
-    }
-
-    for (size_t i = 0; i < len; i++)
-    {
-        fsUploadFile.write(data[i]);
-    }
-
-    if (final)
-    {
-        String JSON;
-        StaticJsonDocument<100> jsonBuffer;
-
-        jsonBuffer["success"] = LittleFS.exists(filename); //fsUploadFile.isFile();
-        serializeJson(jsonBuffer, JSON);
-
-        request->send(200, PSTR("text/html"), JSON);
-        fsUploadFile.close();
-    } });
+    // Files are buffered and checked per request, e.g., curl -F "f=@history.csv" -H "X-CRC32: 8a9136aa" http://oilgauge.local/api/files/upload
+    _webServer.on(PSTR("/api/files/upload"), HTTP_POST, [](AsyncWebServerRequest *request)
+                  { _endUpload(request); },
+                  [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
+                  { _upload(request, filename, index, data, len, final); });
 
     //-- Handle removing file request
     _webServer.on(PSTR("/api/files/remove"), HTTP_POST, [](AsyncWebServerRequest *request)
@@ -638,11 +1753,70 @@ void EspClient::setupPortal(bool blocking) // char const *apName, char const *ap
       request->send(500, PSTR("text/html"), "File does not exists!");
     } });
 
+    //-- Latest measures from the cache, never triggers a sensor read. e.g., /api/measure?stale=60
+    _webServer.on("/api/measure", HTTP_GET, [](AsyncWebServerRequest *request)
+                  {
+    if (!_lowMemory(request))
+        _sendMeasures(request); });
+
+    //-- Live view: every new measure is pushed as a "measure" event, e.g.,
+    // {"sensor":"sr04","channel":"distance","value":50.1}
+    MeasureBus::instance().onPublish([&](const MeasureBus::Entry &entry)
+                                     {
+    if (_events.count() == 0)
+        return;
+
+    char data[100];
+    snprintf(data, sizeof(data), "{\"sensor\":\"%s\",\"channel\":\"%s\",\"value\":%.2f}", entry.sensor, entry.channel, entry.value);
+    _events.send(data, "measure", entry.ms); });
+    _webServer.addHandler(&_events);
+
+    //-- Binary trace dump, decoded on the host by tools/trace_decode.cpp.
+    // /api/trace?saved returns the trace saved at the last restart (or crash) instead.
+    _webServer.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest *request)
+                  {
+    if (request->hasParam("saved"))
+    {
+        if (LittleFS.exists(TRACE_FILE))
+            request->send(LittleFS, TRACE_FILE, "application/octet-stream", true);
+        else
+            request->send(404, "text/plain", "No saved trace");
+        return;
+    }
+
+    if (_lowMemory(request))
+        return;
+
+    // snapshot now, the response is sent asynchronously
+    size_t size = trace.dumpSize();
+    std::shared_ptr<uint8_t> dump(new (std::nothrow) uint8_t[size], std::default_delete<uint8_t[]>());
+    if (!dump)
+    {
+        request->send(503, "text/plain", "Low memory");
+        return;
+    }
+    size = trace.dump(dump.get(), size);
+
+    AsyncWebServerResponse *response = request->beginResponse("application/octet-stream", size,
+        [dump, size](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+        {
+            size_t n = min(maxLen, size - index);
+            memcpy(buffer, dump.get() + index, n);
+            return n;
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=trace.bin");
+    request->send(response); });
+
+    //-- Counters and histograms in Prometheus text format
+    _webServer.on("/metrics", HTTP_GET, [&](AsyncWebServerRequest *request)
+                  { _sendMetrics(request); });
+
     //-- Handle retrieval of the config.json requested by client browser (send it!)
+    // The file response is streamed from LittleFS as the TCP window allows, no copy of the file in RAM.
     _webServer.on("/api/config/get", HTTP_GET, [](AsyncWebServerRequest *request)
                   {
     Serial.println("Get config.");
-    request->send(LittleFS, "/config.json", "text/plain"); });
+    request->send(LittleFS, "/config.json", "application/json"); });
 
     //-- Receiving the updated configuration Json file
     // NOTE: It uses AsyncCallbackJsonWebHandler!!
@@ -663,12 +1837,13 @@ void EspClient::setupPortal(bool blocking) // char const *apName, char const *ap
     {
       cfg.saveConfig();
       request->send(200, "application/json", buffer);
-    } }));
+    } }, JSON_CAPACITY));
 
     // Do not close the webserver, instead set it response 404 instead, then the webOTA is still on
     _webServer.onNotFound([](AsyncWebServerRequest *request)
                           { request->send(404, "text/plain", "Not found"); });
 
+    _setupOtaApi();
     AsyncElegantOTA.begin(&_webServer); // Start ElegantOTA right before webserver start
 
     if (!_wifiConnected)
@@ -682,17 +1857,6 @@ void EspClient::setupPortal(bool blocking) // char const *apName, char const *ap
     // if(_wifiConnected) Serial.printf("Browse http://%s/ or %s for portal, or\n", cfg.module.c_str(), WiFi.localIP().toString().c_str());
     // Serial.printf("Connect to Wifi \"%s\" and browse http://%s/ or %s.\n", ssid, cfg.module.c_str(), WiFi.softAPIP().toString().c_str());
     _printLine();
-
-    if (blocking)
-    {
-        // blocking mode, open untill configuration is done!
-        Serial.println(F("Portal open on blocking mode."));
-        while (_portalOn && !_portalSubmitted)
-        {
-            loop();
-            delay(1000);
-        }
-    }
 }
 
 void EspClient::_startAP()
@@ -755,26 +1919,65 @@ void EspClient::_stopAP()
 }
 
 void EspClient::timerCallback(Timer &timer)
+{
+    uint32_t start = micros();
+    int action = timer.action; // the timer may be reused by the action
+
+    _timerAction(timer);
+
+    uint32_t elapsed = micros() - start;
+    if (action < METRIC_ACTIONS)
+        metrics.action[action].add(elapsed);
+    profiler.tag(PT_ACTION + action, elapsed);
+    if (elapsed > TRACE_SLOW_US)
+        TRACE(EV_SLOW_ACTION, action, elapsed);
+}
+
+void EspClient::_timerAction(Timer &timer)
 {
     switch (timer.action)
     {
     case ACT_HEARTBEAT:
     {
         static String mqtt_pub_heartbeat = cfg.module + MQTT_PUB_HEARTBEAT;
-        mqttClient.publish(mqtt_pub_heartbeat.c_str(), 0, true); // send heartbeat message
+        mqttQueue.push(mqtt_pub_heartbeat.c_str(), "", PRI_STATUS, 0, true); // send heartbeat message
         _blink();
+        otaUpdate.check(); // abort an abandoned OTA session
+        if (_connState != CS_Resolve)
+            resolver.poll(); // background lookup answer
+
+        // Boot report once connected, with the NTP sync time unless it takes too long
+        if (!metrics.boot.sent && _mqttConnected &&
+            (_NtpSynched || BootReport::now() - metrics.boot.mqttConn > BOOT_NTP_WAIT))
+            _sendBootReport();
         break;
     }
 
     case ACT_MEASURE:
-#ifdef _DEBUG
-        Serial.println(F("TIMER: ACT_MEASURE"));
-#endif
-
         if (_autoMode)
             _measure();
         break;
 
+    case ACT_DIAG:
+        _sendDiag();
+        break;
+
+    case ACT_MEMORY:
+        if (memGuard.update())
+            _sendDiag(); // status on the level change
+
+        if (memGuard.restartDue())
+            _restart(RS_LOW_MEMORY);
+        break;
+
+    case ACT_CMD_TRACE:
+        _sendTrace();
+        break;
+
+    case ACT_CMD_PROFILE:
+        _sendProfile();
+        break;
+
     case ACT_CMD_SYNC_NTP:
     {
 #ifdef _DEBUG
@@ -782,10 +1985,13 @@ void EspClient::timerCallback(Timer &timer)
 #endif
 
         time_t now = time(nullptr); // When NTP is not synched, the returned "now" is just a sequence number
-        if (now > 1617460172)       // minimum valid epoch
+        if (now > EPOCH_VALID)
         {
             timer.enable = false; // disable the sync timer when it's been synched
             _NtpSynched = true;
+            if (metrics.boot.ntp == 0)
+                metrics.boot.ntp = BootReport::now();
+            TRACE(EV_NTP_SYNC, now);
 
             _printLine();
             Serial.print(F("NTP Synched: "));
@@ -804,60 +2010,11 @@ void EspClient::timerCallback(Timer &timer)
         Serial.println(F("TIMER: ACT_CMD_MEASURE"));
 #endif
 
-        _measure();
-        break;
-
-    case ACT_MQTT_RECONNECT:
-    {
-        int repetitions = timer.repetitions;
-
-#ifdef _DEBUG
-        Serial.println(F("TIMER: ACT_MQTT_RECONNECT"));
-        if (_mqttConnected)
-            Serial.println(F("MQTT connected already"));
-        Serial.print(F("Repetitions: "));
-        Serial.println(repetitions);
-#endif
-
-        if (repetitions > 1)
-        {
-            // Not reaching the maximum number of reconnect attempts;
-            // continue if Wi-Fi is on but MQTT is not.
-            if (_wifiConnected && !_mqttConnected)
-                _connectToMqttBroker();
-        }
-        else
-        {
-            // Upon reaching the maximum number of attempts, create a longer timer if not connected,
-            // meaning MQTT will keep trying until it connects.
-            if (!_mqttConnected)
-            {
-                // Reset MQTT connect timer to longer interval if wifi is not connected, otherwise use the same interval
-                jTimer.setTimer(this, ACT_MQTT_RECONNECT,
-                                _wifiConnected ? MQTT_RECONNECT_INTERVAL : MQTT_RECONNECT_INTERVAL_LONG, MQTT_MAX_TRY);
-            }
-        }
+        _measure(true);
         break;
-    }
-
-    case ACT_MQTT_SUBSCRIBE:
-#ifdef _DEBUG
-        Serial.println(F("TIMER: ACT_MQTT_SUBSCRIBE"));
-#endif
-
-        // check mqtt connection before subscribe. MQTT broker disconnection can happen!
-        if (_mqttConnected)
-        {
-            String module = String(cfg.module);
-            // module.toLowerCase();
-            auto cmdTopic = module + "/cmd/#";
-
-            Serial.print(F("Subscribe command topic: "));
-            Serial.println(cmdTopic);
 
-            // subscribe command topics
-            mqttClient.subscribe(cmdTopic.c_str(), 2);
-        }
+    case ACT_CONNECT:
+        _connectStep();
         break;
     }
 }
@@ -877,16 +2034,45 @@ void EspClient::_blink()
     }
 }
 
-// Instruct all sensors to perform measurements.
-void EspClient::_measure()
+// Instruct the sensors due (or all sensors if forced) to perform measurements.
+// Sampling starts at boot, the measures taken before the NTP sync are held in the queue and
+// sent with their corrected timestamps once synced (see MqttQueue::pushStamped()).
+void EspClient::_measure(bool force)
 {
+    unsigned long now = millis();
+
     for (Sensor *pSensor : _sensors)
     {
-        if (pSensor != NULL && isConnected())
+        if (pSensor != NULL && !pSensor->isSource() && (force || pSensor->isDue(now)))
             pSensor->sendMeasure();
     }
 }
 
+// Take a high-rate sample on the sensors in cycle detection mode when due.
+// It keeps running while disconnected, the cycle events are queued.
+void EspClient::_acquire()
+{
+    unsigned long now = millis();
+
+    for (Sensor *pSensor : _sensors)
+    {
+        if (pSensor != NULL && pSensor->isAcquireDue(now))
+            pSensor->acquire();
+    }
+}
+
+// Find sensor by name, NULL if not found
+Sensor *EspClient::_findSensor(const char *name)
+{
+    for (Sensor *pSensor : _sensors)
+    {
+        if (pSensor != NULL && strcmp(name, pSensor->name) == 0)
+            return pSensor;
+    }
+
+    return NULL;
+}
+
 // Enable/Disable sensor by name
 void EspClient::_enableSensor(const char *name, bool enable)
 {
@@ -944,17 +2130,27 @@ void EspClient::_cmdHandler(const char *topic, const char *payload)
     }
     else if (strcmp(topic, CMD_INTERVAL) == 0)
     {
-        // reset the interval of the timer
-        Timer *pTimer = jTimer.getTimer(ACT_MEASURE);
-        if (NULL != pTimer)
-            jTimer.getTimer(ACT_MEASURE)->delay = atoi(payload) * 1000;
-        else
-            Serial.println(F("ERROR: Null measure timer!"));
+        // reset the sampling interval of the sensors not on adaptive sampling
+        for (Sensor *pSensor : _sensors)
+        {
+            if (pSensor != NULL && !pSensor->isAdaptive())
+                pSensor->setInterval(atoi(payload) * 1000);
+        }
     }
     else if (strcmp(topic, CMD_RESTART) == 0)
     {
         _restart();
     }
+    else if (strcmp(topic, CMD_PROFILE) == 0)
+    {
+        _startProfile(payload);
+    }
+    else if (strcmp(topic, CMD_TRACE) == 0)
+    {
+        // the dump is sent chunk by chunk from the action timer, do not start over while sending
+        if (_traceDump == NULL)
+            jTimer.setInterval(this, ACT_CMD_TRACE, 100);
+    }
     else if (strstr(topic, "/cmd/on/") != NULL)
     {
         // find he last occurrence of '/'
@@ -1011,6 +2207,13 @@ void EspClient::_restart(RsCode code)
     Serial.print(F("Restart device, code: "));
     Serial.println(code);
 
+    // keep the trace of this run on LittleFS, served by /api/trace?saved
+    TRACE(EV_RESTART, code);
+    trace.save();
+
+    if (code == RS_LOW_MEMORY)
+        memGuard.save(_autoMode, _ledBlink);
+
     // disconnect mqtt broker
     mqttClient.disconnect(true);
 
@@ -6,6 +6,16 @@
 #include "JTimer.h"
 #include "sensor.hpp"
 #include "Config.hpp"
+#include "MqttQueue.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Profiler.hpp"
+#include "MemGuard.hpp"
+#include "Crc32.hpp"
+#include "OtaUpdate.hpp"
+#include "Backoff.hpp"
+#include "Resolver.hpp"
+#include "Clock.hpp"
 
 #include "ESPAsyncWebServer.h"
 #include "vector"
@@ -24,8 +34,6 @@
 #error Platform not supported
 #endif
 
-// Known issu: ESP32 FS.h does not have interface to get used/max disk space!!
-
 //----------------------
 // Actuator MQTT command message topics
 
@@ -41,6 +49,8 @@
 #define CMD_RESTART "/cmd/restart"
 #define CMD_RESET_WIFI "/cmd/reset_wifi" // earase wifi credential from flash
 #define CMD_SSR_FILTER "/cmd/filter"
+#define CMD_TRACE "/cmd/trace" // send the trace dump on MQTT_PUB_TRACE
+#define CMD_PROFILE "/cmd/profile" // "<seconds>,<pc|tag>", report on MQTT_PUB_PROFILE
 
 // #define CMD_SSR_SR04    "/cmd/on/sr04"  // toggle the sensor on/off
 // #define CMD_SSR_VL53    "/cmd/on/vl53"
@@ -51,6 +61,10 @@
 // #define MQTT_PUB_DH11   "/sensor/dh11"
 
 #define MQTT_PUB_HEARTBEAT "/heartbeat"
+#define MQTT_PUB_DIAG "/diag"
+#define MQTT_PUB_BOOT "/boot"
+#define MQTT_PUB_TRACE "/trace"
+#define MQTT_PUB_PROFILE "/profile"
 
 // #define MQTT_PUB_INFO       "/msg/info"
 // #define MQTT_PUB_WARN       "/msg/warn"
@@ -59,11 +73,24 @@
 
 //---------------------------------------
 // Timer default value
-#define MQTT_MAX_TRY 15                   // Max number of MQTT connect tries before ask for turn on portal
-#define MQTT_RECONNECT_INTERVAL 5e3       // Time interval between each MQTT reconnection attempt, 2s by default
-#define MQTT_RECONNECT_INTERVAL_LONG 10e3 // Time interval between each MQTT reconnection attempt, 2s by default
+#define MQTT_RETRY_BASE 2e3               // MQTT connect backoff, first retry delay (jittered)
+#define MQTT_RETRY_CAP 120e3              // MQTT connect backoff, max retry delay
 #define MQTT_SUBSCRIBE_DELAY 1e3          // MQTT subscribe attempt delay after connected
+#define SUBSCRIBE_RETRY_BASE 5e3          // Subscribe backoff if not acknowledged
+#define SUBSCRIBE_RETRY_CAP 60e3
 #define WIFI_CONNECTING_TIMEOUT 20e3      // Wifi connecting timeout, 20s by default
+#define WIFI_RETRY_BASE 5e3               // Wi-Fi rejoin backoff, added to the connecting timeout
+#define WIFI_RETRY_CAP 300e3
+#define RESOLVE_POLL 100                  // Broker lookup answer polling interval, no cached address yet
+#define RESOLVE_RETRY_BASE 2e3            // Broker lookup backoff if it failed
+#define RESOLVE_RETRY_CAP 60e3
+#define MEASURE_TICK 100                  // Time interval checking if any sensor is due for measure
+#define MEASURE_INTERVAL 2e3              // Default sensor sampling interval, 2s by default
+#define BOOT_NTP_WAIT 30e3                // Max time waiting for NTP after MQTT connect before sending the boot report
+#define DIAG_INTERVAL 60e3                // Time interval of the MQTT diagnostic message, 1min by default
+#define MEASURE_STALE 600e3               // Cached measure older than this is flagged stale in /api/measure, 10min by default
+
+#define UPLOAD_BUFFER 512 // File upload write buffer, multiple of the LittleFS page size
 
 typedef std::function<void(const char *topic, const char *payload)> CommandHandler;
 
@@ -78,17 +105,17 @@ public:
     static EspClient &instance();
     ~EspClient() {};
 
-    AsyncMqttClient mqttClient;
+    MqttClient mqttClient;
 
     inline bool isConnected() const { return _wifiConnected && _mqttConnected && _NtpSynched; }; // Return true if everything is connected
 
     // Portal
-    void setupPortal(bool blocking = false);
+    void setupPortal();
 
     void setup(); // Config and connection establishment: WiFi, MQTT, OTA, Init Sensors, etc.
     void loop();  // Run EspClient tasks: sensor measurement and publishing, web portal handling, actuator MQTT commands, and Wi-Fi/MQTT reconnections.
 
-    virtual void timerCallback(Timer &timer);
+    virtual void timerCallback(Timer &timer); // times the action into the metrics
 
 protected:
 private:
@@ -105,7 +132,8 @@ private:
         RS_WIFI_DISCONNECT,
         RS_MQTT_DISCONNECT,
         RS_DISCONNECT,
-        RS_CFG_CHANGE
+        RS_CFG_CHANGE,
+        RS_LOW_MEMORY // the state is kept in RTC memory
     };
 
     void _restart(RsCode code = RS_NORMAL); // restart the device
@@ -115,10 +143,17 @@ private:
 
     // Web portal related
     bool _portalOn = false;        // indicate if configuration portal is on
-    bool _portalSubmitted = false; // The configuration form submitted
     char _portalReason[50];        // reason of open portal (Not used at this moment.)
 
     AsyncWebServer _webServer = AsyncWebServer(80); // Mini web server object
+    AsyncEventSource _events{"/api/events"};        // Server-Sent Events of the new measures for live views
+
+    static void _sendMeasures(AsyncWebServerRequest *request); // latest cached measures as JSON
+    static void _sendFileList(AsyncWebServerRequest *request); // LittleFS file list as a chunked JSON response
+    static void _upload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
+    static void _endUpload(AsyncWebServerRequest *request);
+    static bool _lowMemory(AsyncWebServerRequest *request);    // reply 503 if heavy requests are paused
+    void _setupAssets();                                       // portal page and assets, embedded or LittleFS override
 
     // WiFi related
     bool _wifiConnected = false;
@@ -132,38 +167,88 @@ private:
     bool _mqttConnected = false;
     void _setupMQTT();
     void _connectToMqttBroker();
+
+    // Connection state machine, moved by the Wi-Fi/MQTT events. The attempt of the current stage
+    // runs from the ACT_CONNECT timer, retried with the backoff of the stage until the next event.
+    enum ConnState
+    {
+        CS_Wifi,      // joining the AP
+        CS_Resolve,   // looking up the broker address, none cached
+        CS_Mqtt,      // connecting to the broker
+        CS_Subscribe, // subscribing the command topics
+        CS_Online
+    };
+    ConnState _connState = CS_Wifi;
+    Backoff _wifiBackoff{(uint32_t)WIFI_RETRY_BASE, (uint32_t)WIFI_RETRY_CAP};
+    Backoff _resolveBackoff{(uint32_t)RESOLVE_RETRY_BASE, (uint32_t)RESOLVE_RETRY_CAP};
+    Backoff _mqttBackoff{(uint32_t)MQTT_RETRY_BASE, (uint32_t)MQTT_RETRY_CAP};
+    Backoff _subscribeBackoff{(uint32_t)SUBSCRIBE_RETRY_BASE, (uint32_t)SUBSCRIBE_RETRY_CAP};
+    void _setConnState(ConnState state, uint32_t delay); // enter a stage, its attempt runs after delay (ms)
+    void _connectStep();                                 // attempt of the current stage
 #ifdef _DEBUG
     void _printMqttDisconnectReason(AsyncMqttClientDisconnectReason reason);
 #endif
 
     // OTA related
     void _setupOTA();
+    void _setupOtaApi();                                             // resumable OTA on /api/ota/*
+    static void _sendOtaStatus(AsyncWebServerRequest *request, int code); // session status as JSON
     void _cmdHandler(const char *topic, const char *payload);
 
     // Timer action IDs
     enum
     {
         ACT_HEARTBEAT, // heartbeat
-        ACT_MEASURE,   // sensor measure timer
-
-        ACT_MQTT_RECONNECT, // MQTT reconnect try (max count of try defined in _nMaxMqttReconnect)
+        ACT_MEASURE,   // sensor measure tick, each sensor is measured on its own sampling interval
+        ACT_DIAG,      // MQTT diagnostic message
+        ACT_MEMORY,    // heap sampling of the low-memory governor
 
         //-- One-off timers
-        ACT_MQTT_SUBSCRIBE, // MQTT subscribe action better delay sometime when MQTT connected. This is delayed time out for subscribing
+        ACT_CONNECT, // next attempt of the connection state machine
         // ACT_CMD_RESET_WIFI,
         ACT_CMD_SYNC_NTP, // synch internet time
         ACT_CMD_RESTART,  // restart
-        ACT_CMD_MEASURE   // manual measure timer
+        ACT_CMD_MEASURE,  // manual measure timer
+        ACT_CMD_TRACE,    // send the next chunk of the trace dump
+        ACT_CMD_PROFILE   // end of the profile run, then send the next part of the report
     };
 
+    void _timerAction(Timer &timer); // run the timer action
+
+    // Diagnostics
+    void _sendMetrics(AsyncWebServerRequest *request); // Prometheus text exposition
+    void _sendDiag();                                  // compact MQTT diagnostic
+    void _sendBootReport();                            // boot timeline, once
+
+    // Trace dump sent over MQTT in chunks
+    uint8_t *_traceDump = NULL; // snapshot of the trace, NULL if not sending
+    size_t _traceSize = 0;
+    size_t _traceSent = 0;
+    void _sendTrace(); // send the next chunk, free the snapshot when done
+
+    // Profiler report sent over MQTT in parts
+    int _profileNext = -1; // next report entry, -1 if not reporting
+    int _profilePart = 0;
+    int _profileCount = 0; // number of report entries
+    void _startProfile(const char *payload);
+    void _sendProfile(); // stop the run on the first call, then send the next part of the report
+    bool _profileEntry(int index, char *buf, size_t size); // "key":value of the report entry
+
     // Sensors
     bool _ledBlink = true;
     bool _autoMode = true;
     std::vector<Sensor *> _sensors;
 
     void _initSensors();
+    void _configChannels(Sensor *pSensor, JsonObject channels); // per measure channel settings, e.g., alarms
+    void _configSampling(Sensor *pSensor, JsonObject sampling); // fixed or adaptive sampling interval
+    void _configCycle(Sensor *pSensor, JsonObject cycle);       // high-rate pump cycle detection
+    void _configAir(Sensor *pSensor, JsonObject air);           // air temperature and humidity source on the bus
+    void _configTank(Sensor *pSensor, JsonObject tank);         // tank model for the volume
+    Sensor *_findSensor(const char *name);
     void _enableSensor(const char *name, bool enable);
-    void _measure();
+    void _measure(bool force = false); // measure the sensors due, or all sensors if forced
+    void _acquire();                   // high-rate sampling of the sensors in cycle detection mode
     void _blink();
 
     // Helper function for debug info
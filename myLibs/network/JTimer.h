@@ -8,7 +8,7 @@
 #undef max
 #endif
 
-#define MAX_TIMERS 10
+#define MAX_TIMERS 16
 
 class IJTimerListener;
 
@@ -0,0 +1,114 @@
+#include "MemGuard.hpp"
+#include "Trace.hpp"
+
+#ifdef ESP32
+// Not initialized on a software reset
+RTC_NOINIT_ATTR static MemGuard::Saved _rtcSaved;
+#endif
+
+MemGuard &MemGuard::instance()
+{
+    static MemGuard _instance;
+    return _instance;
+}
+
+void MemGuard::heapInfo(uint32_t &free, uint32_t &block, uint32_t &frag)
+{
+    free = ESP.getFreeHeap();
+#ifdef ESP8266
+    block = ESP.getMaxFreeBlockSize();
+    frag = ESP.getHeapFragmentation();
+#elif defined(ESP32)
+    block = ESP.getMaxAllocHeap();
+    frag = free > 0 ? 100 - block * 100 / free : 0;
+#endif
+}
+
+void MemGuard::reset(uint32_t pause, uint32_t shrink, uint32_t defer, uint32_t restart)
+{
+    _thresholds[ML_Pause] = pause;
+    _thresholds[ML_Shrink] = shrink;
+    _thresholds[ML_Defer] = defer;
+    _thresholds[ML_Restart] = restart;
+}
+
+// Highest level whose threshold is crossed, margin added to the thresholds
+MemLevel MemGuard::_levelOf(uint32_t free, uint32_t block, uint32_t margin) const
+{
+    for (int level = ML_Restart; level > ML_Normal; level--)
+    {
+        uint32_t threshold = _thresholds[level] + margin;
+        if (free < threshold || block < threshold / 2)
+            return (MemLevel)level;
+    }
+
+    return ML_Normal;
+}
+
+bool MemGuard::update()
+{
+    heapInfo(free, block, frag);
+    minFree = min(minFree, free);
+    minBlock = min(minBlock, block);
+    maxFrag = max(maxFrag, frag);
+
+    // escalate right away, step down only with the hysteresis margin
+    MemLevel level = _levelOf(free, block, 0);
+    if (level < _level)
+        level = max(level, _levelOf(free, block, MEM_HYSTERESIS));
+
+    _hold = level == ML_Restart ? _hold + 1 : 0;
+
+    if (level == _level)
+        return false;
+
+    Serial.printf("Memory level %d -> %d, heap %u, block %u\n", _level, level, free, block);
+    TRACE(EV_MEM_LEVEL, level, free, block);
+
+    _level = level;
+    changes++;
+    return true;
+}
+
+void MemGuard::save(bool autoMode, bool ledBlink)
+{
+    Saved state = saved;
+    state.magic = MEM_RTC_MAGIC;
+    state.restarts++;
+    state.minFree = minFree;
+    state.autoMode = autoMode;
+    state.ledBlink = ledBlink;
+
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(MEM_RTC_OFFSET, (uint32_t *)&state, sizeof(state));
+#elif defined(ESP32)
+    _rtcSaved = state;
+#endif
+}
+
+bool MemGuard::restore()
+{
+    Saved state;
+#ifdef ESP8266
+    if (!ESP.rtcUserMemoryRead(MEM_RTC_OFFSET, (uint32_t *)&state, sizeof(state)))
+        return false;
+#elif defined(ESP32)
+    state = _rtcSaved;
+#endif
+
+    // RTC memory is random after power up
+    if (state.magic != MEM_RTC_MAGIC)
+        return false;
+
+    saved = state;
+
+    // the restart count is kept, the rest is restored only once
+    Saved cleared = state;
+    cleared.magic = 0;
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(MEM_RTC_OFFSET, (uint32_t *)&cleared, sizeof(cleared));
+#elif defined(ESP32)
+    _rtcSaved = cleared;
+#endif
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define MEM_INTERVAL 1e3          // Heap sampling interval
+#define MEM_HYSTERESIS 1024       // Free heap above the threshold needed to step a level down
+#define MEM_RESTART_HOLD 30       // Consecutive samples at ML_Restart before the graceful restart
+#define MEM_RTC_OFFSET 32         // RTC user memory offset (4 byte blocks) of the saved state, the first 128 bytes are the OTA bootloader command
+#define MEM_RTC_MAGIC 0x314D454D  // "MEM1"
+
+// Degradation stages, each one includes the previous ones
+enum MemLevel
+{
+    ML_Normal = 0,
+    ML_Pause,   // pause the heavy portal requests, e.g., file listing
+    ML_Shrink,  // shrink the MQTT batch sizes, e.g., trace chunks
+    ML_Defer,   // defer the replay of buffered data (trace, profile report)
+    ML_Restart, // restart gracefully if it lasts MEM_RESTART_HOLD samples
+    ML_COUNT
+};
+
+/*
+Low-memory governor. The free heap and the largest free block are sampled every MEM_INTERVAL
+and mapped to a level by the free heap thresholds (the largest block by half of them, so a
+fragmented heap escalates too). A level is entered as soon as its threshold is crossed and left
+once the heap is MEM_HYSTERESIS above it. The state to keep across the low-memory restart
+is saved in RTC memory, which survives a software reset.
+*/
+class MemGuard
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static MemGuard &instance();
+    ~MemGuard() {};
+
+    // State kept across a low-memory restart
+    struct Saved
+    {
+        uint32_t magic;    // MEM_RTC_MAGIC if valid
+        uint32_t restarts; // number of consecutive low-memory restarts
+        uint32_t minFree;  // min free heap of the run before the restart
+        uint8_t autoMode;
+        uint8_t ledBlink;
+        uint8_t reserved[2];
+    };
+
+    static void heapInfo(uint32_t &free, uint32_t &block, uint32_t &frag); // heap status of the platform
+
+    void reset(uint32_t pause, uint32_t shrink, uint32_t defer, uint32_t restart); // free heap thresholds
+    bool update(); // sample the heap, return true if the level changed
+
+    MemLevel level() const { return _level; };
+    bool restartDue() const { return _hold >= MEM_RESTART_HOLD; };
+    size_t batch(size_t size) const { return _level >= ML_Shrink ? max(size / 4, (size_t)32) : size; }; // shrunk batch size
+
+    void save(bool autoMode, bool ledBlink); // before the low-memory restart
+    bool restore();                          // state saved by a low-memory restart, cleared once restored
+
+    // Last sample and watermarks since boot
+    uint32_t free = 0;
+    uint32_t block = 0;
+    uint32_t frag = 0;
+    uint32_t minFree = UINT32_MAX;
+    uint32_t minBlock = UINT32_MAX;
+    uint32_t maxFrag = 0;
+    uint32_t changes = 0; // level changes
+    Saved saved = {0};    // restored state, saved.restarts counts the low-memory restarts
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    MemGuard() {};
+    MemGuard(const MemGuard &) = delete;            // deleting copy constructor.
+    MemGuard &operator=(const MemGuard &) = delete; // deleting copy operator.
+
+    uint32_t _thresholds[ML_COUNT] = {0, 12000, 9000, 7000, 4000};
+    MemLevel _level = ML_Normal;
+    uint16_t _hold = 0; // consecutive samples at ML_Restart
+
+    MemLevel _levelOf(uint32_t free, uint32_t block, uint32_t margin) const;
+};
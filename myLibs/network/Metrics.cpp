@@ -0,0 +1,60 @@
+#include "Metrics.hpp"
+
+Metrics &Metrics::instance()
+{
+    static Metrics _instance;
+    return _instance;
+}
+
+void Histogram::add(uint32_t us)
+{
+    count++;
+    sum += us;
+    if (us > max)
+        max = us;
+
+    // bucket of the smallest power of 2 not less than us
+    int bits = us > 1 ? 32 - __builtin_clz(us - 1) : 0;
+    int i = bits > HIST_BASE ? bits - HIST_BASE : 0;
+    if (i < HIST_BUCKETS)
+        buckets[i]++;
+}
+
+void Metrics::writeType(Print &out, const char *name, const char *type)
+{
+    out.printf("# TYPE %s %s\n", name, type);
+}
+
+// e.g., esp_read_us_bucket{sensor="sr04",le="64"} 12
+void Metrics::writeHistogram(Print &out, const char *name, const char *labels, const Histogram &hist)
+{
+    const char *sep = labels != NULL ? "," : "";
+    if (labels == NULL)
+        labels = "";
+
+    uint32_t cumulative = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        cumulative += hist.buckets[i];
+        out.printf("%s_bucket{%s%sle=\"%lu\"} %lu\n", name, labels, sep, 1UL << (i + HIST_BASE), cumulative);
+    }
+    out.printf("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, hist.count);
+
+    const char *open = *labels ? "{" : "";
+    const char *close = *labels ? "}" : "";
+    out.printf("%s_sum%s%s%s %llu\n", name, open, labels, close, hist.sum);
+    out.printf("%s_count%s%s%s %lu\n", name, open, labels, close, hist.count);
+}
+
+void Metrics::writeCounter(Print &out, const char *name, const char *labels, uint32_t value)
+{
+    if (labels == NULL)
+        out.printf("%s %lu\n", name, value);
+    else
+        out.printf("%s{%s} %lu\n", name, labels, value);
+}
+
+void Metrics::writeGauge(Print &out, const char *name, const char *labels, uint32_t value)
+{
+    writeCounter(out, name, labels, value);
+}
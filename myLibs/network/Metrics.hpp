@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define HIST_BUCKETS 16 // Histogram buckets, bucket i counts durations up to 2^(i+HIST_BASE) us
+#define HIST_BASE 5     // Lowest bucket bound is 32 us, the highest 1 s (the rest goes to +Inf only)
+#define METRIC_ACTIONS 16 // Max number of timed JTimer actions
+
+/*
+Duration histogram (us) with power of 2 buckets. add() is a few integer operations,
+cheap enough for the hot paths (loop, timer callbacks, sensor reads).
+*/
+class Histogram
+{
+public:
+    void add(uint32_t us);
+
+    uint32_t count = 0;
+    uint64_t sum = 0; // us
+    uint32_t max = 0; // us
+    uint32_t buckets[HIST_BUCKETS] = {0}; // not cumulative, bucket i is (2^(i+HIST_BASE-1), 2^(i+HIST_BASE)]
+
+    uint32_t mean() const { return count > 0 ? sum / count : 0; };
+};
+
+/*
+Boot timeline, in ms since power up (millis()) at the end of each setup phase and at the
+first connection events. 0 means not reached yet. Published once after the first MQTT connect.
+*/
+struct BootReport
+{
+    // EspClient::setup() phases, in order
+    uint32_t start = 0;   // setup() entered
+    uint32_t config = 0;  // config loaded
+    uint32_t portal = 0;  // web portal up
+    uint32_t wifi = 0;    // Wi-Fi setup
+    uint32_t ota = 0;     // OTA setup
+    uint32_t mqtt = 0;    // MQTT client setup
+    uint32_t join = 0;    // Wi-Fi connected (blocking in setup)
+    uint32_t sensors = 0; // sensors initialized
+    uint32_t setup = 0;   // setup() done
+
+    // Connection events
+    uint32_t gotIp = 0;    // first GOT_IP
+    uint32_t resolved = 0; // first broker address known, cached or looked up
+    uint32_t mqttConn = 0; // first MQTT onConnect
+    uint32_t ntp = 0;      // ACT_CMD_SYNC_NTP completed
+
+    bool sent = false;
+
+    static uint32_t now() { return millis(); };
+};
+
+/*
+Always-on counters and histograms registry. The registry only collects, EspClient
+exposes it as Prometheus text on /metrics and as a periodic compact MQTT diagnostic.
+*/
+class Metrics
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static Metrics &instance();
+    ~Metrics() {};
+
+    Histogram loop;                    // EspClient::loop() iteration time
+    Histogram action[METRIC_ACTIONS]; // JTimer callback time per action
+    Histogram resolve;                 // broker name lookup time, see Resolver
+
+    uint32_t wifiConnects = 0;    // got IP
+    uint32_t wifiDisconnects = 0;
+    uint32_t mqttTries = 0;       // MQTT connect attempts
+    uint32_t mqttConnects = 0;
+    uint32_t mqttDisconnects = 0;
+
+    BootReport boot;
+
+    // Prometheus text exposition helpers. labels is the label list without braces, e.g., sensor="sr04", or NULL
+    static void writeHistogram(Print &out, const char *name, const char *labels, const Histogram &hist);
+    static void writeCounter(Print &out, const char *name, const char *labels, uint32_t value);
+    static void writeGauge(Print &out, const char *name, const char *labels, uint32_t value);
+    static void writeType(Print &out, const char *name, const char *type); // # TYPE line, once per metric name
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    Metrics() {};
+    Metrics(const Metrics &) = delete;            // deleting copy constructor.
+    Metrics &operator=(const Metrics &) = delete; // deleting copy operator.
+};
@@ -0,0 +1,222 @@
+#include "MqttQueue.hpp"
+#include "Trace.hpp"
+#include "Clock.hpp"
+
+MqttQueue &MqttQueue::instance()
+{
+    static MqttQueue _instance;
+    return _instance;
+}
+
+bool MqttQueue::push(const char *topic, const char *payload, MsgPriority pri, uint8_t qos, bool retain, size_t length)
+{
+    if (_enqueue(topic, payload, pri, qos, retain, length) == NULL)
+        return false;
+
+    drain();
+    return true;
+}
+
+bool MqttQueue::pushStamped(const char *topic, const char *payload, size_t stampLen, uint64_t captureUs, uint32_t acqUs,
+                            MsgPriority pri, uint8_t qos, bool retain)
+{
+    if (clockSynced())
+        return push(topic, payload, pri, qos, retain);
+
+    // a small window of samples only: drop the oldest held one of the lowest priority (a held
+    // alarm outlives the measures), the queue stays usable for the rest
+    if (held() >= MQTT_HOLD_MAX)
+    {
+        Msg *pVictim = NULL;
+        for (Msg &msg : _msgs)
+        {
+            if (msg.used && msg.held &&
+                (pVictim == NULL || msg.pri > pVictim->pri || (msg.pri == pVictim->pri && msg.seq < pVictim->seq)))
+                pVictim = &msg;
+        }
+
+        if (pVictim->pri < pri) // all held ones are more important than the new one
+        {
+            dropped[pri]++;
+            TRACE(EV_MQTT_DROP, pri, _count);
+            return false;
+        }
+
+        pVictim->used = false;
+        _count--;
+        dropped[pVictim->pri]++;
+        TRACE(EV_MQTT_DROP, pVictim->pri, _count);
+    }
+
+    Msg *pMsg = _enqueue(topic, payload, pri, qos, retain, 0);
+    if (pMsg == NULL)
+        return false;
+
+    pMsg->held = true;
+    pMsg->stampLen = stampLen;
+    pMsg->captureUs = captureUs;
+    pMsg->acqUs = acqUs;
+    return true;
+}
+
+size_t MqttQueue::held() const
+{
+    size_t n = 0;
+    for (const Msg &msg : _msgs)
+    {
+        if (msg.used && msg.held)
+            n++;
+    }
+    return n;
+}
+
+MqttQueue::Msg *MqttQueue::_enqueue(const char *topic, const char *payload, MsgPriority pri, uint8_t qos, bool retain, size_t length)
+{
+    if (payload == NULL)
+        payload = "";
+
+    if (length == 0)
+        length = strlen(payload);
+
+    if (strlen(topic) >= MQTT_TOPIC_LEN || length > MQTT_PAYLOAD_LEN)
+    {
+        Serial.printf("MQTT: Message too long: %s\n", topic);
+        dropped[pri]++;
+        TRACE(EV_MQTT_DROP, pri, _count);
+        return NULL;
+    }
+
+    Msg *pMsg = _slot(topic, pri);
+    if (pMsg == NULL)
+    {
+        dropped[pri]++;
+        TRACE(EV_MQTT_DROP, pri, _count);
+        return NULL;
+    }
+
+    pMsg->used = true;
+    pMsg->pri = pri;
+    pMsg->qos = qos;
+    pMsg->retain = retain;
+    pMsg->seq = _seq++;
+    pMsg->length = length;
+    pMsg->held = false;
+    strncpy(pMsg->topic, topic, sizeof(pMsg->topic));
+    memcpy(pMsg->payload, payload, length);
+    return pMsg;
+}
+
+MqttQueue::Msg *MqttQueue::_slot(const char *topic, MsgPriority pri)
+{
+    // Status messages only care about the latest value, replace the pending one in place
+    if (pri == PRI_STATUS)
+    {
+        for (Msg &msg : _msgs)
+        {
+            if (msg.used && msg.pri == PRI_STATUS && strcmp(msg.topic, topic) == 0)
+                return &msg;
+        }
+    }
+
+    if (_count < MQTT_QUEUE_SIZE)
+    {
+        for (Msg &msg : _msgs)
+        {
+            if (!msg.used)
+            {
+                _count++;
+                return &msg;
+            }
+        }
+    }
+
+    // Queue full: evict the oldest message of the lowest priority, if it is not more important than the new one.
+    // Queued replay chunks are kept: the subscriber concatenates them, a gap would corrupt the dump.
+    // Their producers only push while the queue is less than half full, so they cannot fill it.
+    Msg *pVictim = NULL;
+    for (Msg &msg : _msgs)
+    {
+        if (msg.pri == PRI_REPLAY)
+            continue;
+
+        if (pVictim == NULL || msg.pri > pVictim->pri || (msg.pri == pVictim->pri && msg.seq < pVictim->seq))
+            pVictim = &msg;
+    }
+
+    if (pVictim == NULL || pVictim->pri < pri)
+        return NULL;
+
+    dropped[pVictim->pri]++;
+    TRACE(EV_MQTT_DROP, pVictim->pri, _count);
+    return pVictim;
+}
+
+MqttQueue::Msg *MqttQueue::_next()
+{
+    bool synced = clockSynced();
+    Msg *pNext = NULL;
+    for (Msg &msg : _msgs)
+    {
+        if (msg.used && (synced || !msg.held) && (pNext == NULL || msg.pri < pNext->pri || (msg.pri == pNext->pri && msg.seq < pNext->seq)))
+            pNext = &msg;
+    }
+
+    return pNext;
+}
+
+void MqttQueue::drain()
+{
+    while (_count > 0 && connected())
+    {
+        Msg *pMsg = _next();
+        if (pMsg == NULL) // only held messages left
+            break;
+
+        if (pMsg->held && !_restamp(pMsg))
+            continue;
+
+        // The client returns 0 if there is not enough space in the TCP send buffer.
+        // Leave the message in the queue and retry on the next loop().
+        if (_pClient->publish(pMsg->topic, pMsg->qos, pMsg->retain, pMsg->payload, pMsg->length) == 0)
+            break;
+
+        published[pMsg->pri]++;
+        bytes[pMsg->pri] += pMsg->length;
+
+        pMsg->used = false;
+        _count--;
+    }
+}
+
+void MqttQueue::clear()
+{
+    for (Msg &msg : _msgs)
+        msg.used = false;
+
+    _count = 0;
+}
+
+// The clock is synced: replace the placeholder stamp with the epoch time of the capture.
+// False (message dropped) if the payload no longer fits.
+bool MqttQueue::_restamp(Msg *pMsg)
+{
+    char stamp[64];
+    int n = writeStamp(stamp, sizeof(stamp), pMsg->captureUs, pMsg->acqUs);
+    size_t body = pMsg->length - pMsg->stampLen;
+
+    if (pMsg->stampLen > pMsg->length || n + body > MQTT_PAYLOAD_LEN)
+    {
+        pMsg->used = false;
+        _count--;
+        dropped[pMsg->pri]++;
+        TRACE(EV_MQTT_DROP, pMsg->pri, _count);
+        return false;
+    }
+
+    memmove(pMsg->payload + n, pMsg->payload + pMsg->stampLen, body);
+    memcpy(pMsg->payload, stamp, n);
+    pMsg->length = n + body;
+    pMsg->held = false;
+    restamped++;
+    return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+
+// MQTT client, AsyncMqttClient over plain TCP, or the same API over TLS if built with -D MQTT_TLS
+#ifdef MQTT_TLS
+#include "TlsMqttClient.hpp"
+typedef TlsMqttClient MqttClient;
+#else
+#include <AsyncMqttClient.h>
+typedef AsyncMqttClient MqttClient;
+#endif
+
+#define MQTT_QUEUE_SIZE 10   // Max number of pending outgoing messages
+#define MQTT_TOPIC_LEN 48    // Max topic length (including null terminator)
+#define MQTT_PAYLOAD_LEN 256 // Max payload length
+#define MQTT_HOLD_MAX 6      // Max number of messages held until the clock sync, the oldest of the lowest priority is dropped
+
+// Priority class of an outgoing message. The lower the value, the higher the priority.
+enum MsgPriority
+{
+    PRI_ALARM = 0,   // Alarm trip/clear, pre-empts everything else
+    PRI_MEASURE = 1, // Sensor measurements
+    PRI_STATUS = 2,  // Heartbeat, diagnostics. A newer message replaces a pending one on the same topic
+    PRI_REPLAY = 3,  // Bulk replay of buffered data, never evicted once queued
+    PRI_COUNT
+};
+
+/*
+All outgoing MQTT messages are pushed into this fixed size queue instead of calling
+mqttClient.publish() directly. The queue is drained highest priority first (FIFO within
+the same priority) as long as the TCP send buffer has room for the next message.
+When the queue is full, the oldest message of the lowest priority class is dropped, except
+replay chunks once queued (a trace dump must arrive whole).
+*/
+class MqttQueue
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static MqttQueue &instance();
+    ~MqttQueue() {};
+
+    void begin(MqttClient *pClient) { _pClient = pClient; };
+    bool connected() const { return _pClient != NULL && _pClient->connected(); };
+
+    // Queue a message and try to send it right away. length 0 means strlen(payload).
+    bool push(const char *topic, const char *payload, MsgPriority pri, uint8_t qos = 0, bool retain = false, size_t length = 0);
+
+    // Queue a message opened by writeStamp() (stampLen bytes) with the capture time of its sample.
+    // Before the clock sync it is held, at most MQTT_HOLD_MAX of them, and its stamp is rewritten
+    // to the epoch time once synced, then it is sent in capture order.
+    bool pushStamped(const char *topic, const char *payload, size_t stampLen, uint64_t captureUs, uint32_t acqUs,
+                     MsgPriority pri, uint8_t qos = 0, bool retain = false);
+
+    void drain(); // Publish pending messages until the queue is empty or the TCP send buffer is full
+    void clear(); // Discard all pending messages
+
+    size_t size() const { return _count; };
+    size_t held() const; // messages waiting for the clock sync
+
+    // Statistics per priority class
+    uint32_t published[PRI_COUNT] = {0}; // number of messages handed to the TCP stack
+    uint32_t dropped[PRI_COUNT] = {0};   // number of messages dropped (queue full or too long)
+    uint32_t bytes[PRI_COUNT] = {0};     // payload bytes handed to the TCP stack
+    uint32_t restamped = 0;              // held messages sent after the clock sync
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    MqttQueue() {};
+    MqttQueue(const MqttQueue &) = delete;            // deleting copy constructor.
+    MqttQueue &operator=(const MqttQueue &) = delete; // deleting copy operator.
+
+    struct Msg
+    {
+        bool used = false;
+        uint8_t pri = PRI_MEASURE;
+        uint8_t qos = 0;
+        bool retain = false;
+        uint32_t seq = 0; // push order, keeps FIFO order within the same priority
+        uint16_t length = 0;
+        bool held = false;      // waiting for the clock sync, then restamped
+        uint8_t stampLen = 0;   // length of the capture time prefix
+        uint32_t acqUs = 0;     // acquisition time of the sample
+        uint64_t captureUs = 0; // monoUs() capture time of the sample
+        char topic[MQTT_TOPIC_LEN];
+        char payload[MQTT_PAYLOAD_LEN];
+    };
+
+    MqttClient *_pClient = NULL;
+
+    Msg _msgs[MQTT_QUEUE_SIZE];
+    size_t _count = 0;
+    uint32_t _seq = 0;
+
+    Msg *_slot(const char *topic, MsgPriority pri); // find a slot for a new message, evict one if needed
+    Msg *_next();                                   // highest priority, oldest pending message, not held
+    Msg *_enqueue(const char *topic, const char *payload, MsgPriority pri, uint8_t qos, bool retain, size_t length);
+    bool _restamp(Msg *pMsg);                       // rewrite the capture time of a held message in epoch time
+};
@@ -0,0 +1,179 @@
+#include "OtaUpdate.hpp"
+#include "Crc32.hpp"
+#include "Trace.hpp"
+
+#ifdef ESP8266
+#include <Updater.h>
+#elif defined(ESP32)
+#include <Update.h>
+#endif
+
+static const char *const STATE_NAMES[] = {"idle", "receiving", "done", "error"};
+
+OtaUpdate &OtaUpdate::instance()
+{
+    static OtaUpdate _instance;
+    return _instance;
+}
+
+bool OtaUpdate::begin(size_t size, const char *md5)
+{
+    // same image: resume where it stopped
+    if (_state == OS_Receiving && size == _size && strcmp(md5, _md5) == 0)
+    {
+        _lastChunk = millis();
+        return true;
+    }
+
+    abort(); // another image
+    _error[0] = '\0';
+
+    if (size == 0 || strlen(md5) != 32)
+        return _fail("invalid size or md5");
+
+    _chunk = (uint8_t *)malloc(OTA_CHUNK);
+    if (_chunk == NULL)
+        return _fail("out of memory");
+
+#ifdef ESP8266
+    Update.runAsync(true); // called from the async web server, no yield()
+#endif
+    if (!Update.begin(size, U_FLASH))
+        return _fail(Update.getErrorString().c_str());
+    Update.setMD5(md5);
+
+    strncpy(_md5, md5, sizeof(_md5) - 1);
+    _size = size;
+    _next = 0;
+    _fill = 0;
+    _lastChunk = millis();
+    _state = OS_Receiving;
+    sessions++;
+
+    Serial.printf("OTA: begin %u bytes, md5 %s\n", size, md5);
+    TRACE(EV_OTA, _state, _next, _size);
+    return true;
+}
+
+bool OtaUpdate::append(size_t index, const uint8_t *data, size_t len)
+{
+    if (_state != OS_Receiving)
+        return false;
+
+    if (index == 0)
+        _fill = 0;
+
+    if (index != _fill || index + len > OTA_CHUNK)
+    {
+        _fill = OTA_CHUNK + 1; // invalid until the next chunk body
+        return false;
+    }
+
+    memcpy(_chunk + index, data, len);
+    _fill += len;
+    return true;
+}
+
+bool OtaUpdate::commit(size_t offset, uint32_t crc)
+{
+    if (_state != OS_Receiving)
+        return false;
+
+    _lastChunk = millis();
+
+    // not the expected chunk, or damaged: the client resumes from next()
+    if (offset != _next || _fill == 0 || _fill > OTA_CHUNK || _next + _fill > _size ||
+        crc32Update(0, _chunk, _fill) != crc)
+    {
+        rejected++;
+        _fill = 0;
+        return false;
+    }
+
+#ifdef ESP32
+    if (offset == 0 && _chunk[0] == 0x1f && _chunk[1] == 0x8b)
+        return _fail("gzip image not supported");
+#endif
+
+    if (Update.write(_chunk, _fill) != _fill)
+        return _fail(Update.getErrorString().c_str());
+
+    _next += _fill;
+    _fill = 0;
+    chunks++;
+    return true;
+}
+
+bool OtaUpdate::end()
+{
+    if (_state != OS_Receiving)
+        return false;
+
+    if (_next < _size)
+    {
+        snprintf(_error, sizeof(_error), "incomplete, %u of %u", _next, _size);
+        return false;
+    }
+
+    // checks the MD5 of the image
+    if (!Update.end())
+        return _fail(Update.getErrorString().c_str());
+
+    _release();
+    _state = OS_Done;
+    Serial.println(F("OTA: image verified"));
+    TRACE(EV_OTA, _state, _next, _size);
+    return true;
+}
+
+void OtaUpdate::abort()
+{
+    if (Update.isRunning())
+    {
+#ifdef ESP8266
+        Update.end(); // an unfinished update is discarded
+#elif defined(ESP32)
+        Update.abort();
+#endif
+    }
+
+    _release();
+    if (_state == OS_Receiving)
+        TRACE(EV_OTA, OS_Idle, _next, _size);
+    _state = OS_Idle;
+    _next = 0;
+}
+
+void OtaUpdate::check()
+{
+    if (_state == OS_Receiving && millis() - _lastChunk > OTA_IDLE_TIMEOUT)
+    {
+        Serial.println(F("OTA: session timeout"));
+        abort();
+        strcpy(_error, "timeout");
+    }
+}
+
+// e.g., {"state":"receiving","size":412345,"next":204800,"percent":49.7,"md5":"...","chunks":100,"rejected":1,"error":""}
+void OtaUpdate::writeStatus(Print &out) const
+{
+    out.printf("{\"state\":\"%s\",\"size\":%u,\"next\":%u,\"percent\":%.1f,\"md5\":\"%s\",\"chunks\":%lu,\"rejected\":%lu,\"error\":\"%s\"}",
+               STATE_NAMES[_state], _size, _next, _size > 0 ? _next * 100.0 / _size : 0.0, _md5, chunks, rejected, _error);
+}
+
+bool OtaUpdate::_fail(const char *error)
+{
+    Serial.printf("OTA: %s\n", error);
+    abort();
+    strncpy(_error, error, sizeof(_error) - 1);
+    _state = OS_Error;
+    TRACE(EV_OTA, _state, _next, _size);
+    return false;
+}
+
+void OtaUpdate::_release()
+{
+    free(_chunk);
+    _chunk = NULL;
+    _fill = 0;
+}
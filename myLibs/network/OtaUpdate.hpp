@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define OTA_CHUNK 2048            // Max chunk size, a chunk is buffered in RAM until its CRC is checked
+#define OTA_IDLE_TIMEOUT 600e3    // A session without chunk for this long is aborted, 10min
+
+enum OtaState
+{
+    OS_Idle = 0,
+    OS_Receiving, // session open, waiting for the next chunk
+    OS_Done,      // image complete and verified, restart pending
+    OS_Error
+};
+
+/*
+Resumable firmware update over HTTP (/api/ota/*), driven by tools/ota_pack.py.
+The image (raw, or gzip-compressed on ESP8266) is sent in chunks at increasing offsets. A chunk
+is written to the update partition only once its CRC-32 matches, and the whole image is checked
+against its MD5 at the end. After a dropped connection the client asks for the next expected
+offset and resumes from there, as long as the device did not restart.
+On ESP8266 a gzip image is staged as is and decompressed by the bootloader at the next boot:
+a streaming inflate would need a 32KB window the heap cannot afford.
+*/
+class OtaUpdate
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static OtaUpdate &instance();
+    ~OtaUpdate() {};
+
+    // Open a session for an image of size bytes, or resume the open one of the same image.
+    // Return false with error() set if the update cannot start.
+    bool begin(size_t size, const char *md5);
+
+    bool append(size_t index, const uint8_t *data, size_t len); // buffer a part of the chunk body
+    bool commit(size_t offset, uint32_t crc);                  // check and write the buffered chunk
+    bool end();                                                 // verify the image, OS_Done if ok
+    void abort();
+    void check(); // abort an idle session
+
+    OtaState state() const { return _state; };
+    size_t size() const { return _size; };
+    size_t next() const { return _next; }; // next expected offset
+    const char *error() const { return _error; };
+    void writeStatus(Print &out) const;    // JSON status
+
+    uint32_t chunks = 0;    // chunks written
+    uint32_t rejected = 0;  // chunks rejected (CRC, offset)
+    uint32_t sessions = 0;  // sessions started, resumes not counted
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    OtaUpdate() {};
+    OtaUpdate(const OtaUpdate &) = delete;            // deleting copy constructor.
+    OtaUpdate &operator=(const OtaUpdate &) = delete; // deleting copy operator.
+
+    OtaState _state = OS_Idle;
+    size_t _size = 0;
+    size_t _next = 0;
+    char _md5[33] = "";
+    char _error[40] = "";
+    unsigned long _lastChunk = 0;
+
+    uint8_t *_chunk = NULL; // chunk buffer, allocated during the session only
+    size_t _fill = 0;
+
+    bool _fail(const char *error);
+    void _release();
+};
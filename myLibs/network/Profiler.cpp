@@ -0,0 +1,135 @@
+#include "Profiler.hpp"
+
+Profiler &Profiler::instance()
+{
+    static Profiler _instance;
+    return _instance;
+}
+
+#ifdef ESP8266
+// Set by start(): instance() is in flash, with the guard of its static, and the ISR may run
+// while the flash cache is off (LittleFS writes)
+static Profiler *_pProfiler = NULL;
+
+// The interrupted program counter is saved in EPC1 when the level-1 interrupt is taken
+static void IRAM_ATTR _onTimer1()
+{
+    uint32_t pc;
+    asm volatile("rsr %0, epc1" : "=r"(pc));
+    _pProfiler->sample(pc);
+}
+#endif
+
+bool Profiler::start(ProfileMode mode)
+{
+    stop();
+
+    run++;
+    samples = 0;
+    lost = 0;
+    duration = 0;
+    memset(_tags, 0, sizeof(_tags));
+
+    if (mode == PM_PC)
+    {
+#ifdef ESP8266
+        if (_slots == NULL)
+            _slots = (Slot *)malloc(PROFILE_SLOTS * sizeof(Slot));
+        if (_slots == NULL)
+            return false;
+        memset(_slots, 0, PROFILE_SLOTS * sizeof(Slot));
+
+        _pProfiler = this;
+
+        // 80MHz / 16 = 5MHz timer ticks
+        timer1_attachInterrupt(_onTimer1);
+        timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+        timer1_write(5000000 / PROFILE_HZ);
+#else
+        return false;
+#endif
+    }
+
+    _start = millis();
+    _mode = mode;
+    _lastMode = mode;
+    return true;
+}
+
+void Profiler::stop()
+{
+    if (_mode == PM_Off)
+        return;
+
+#ifdef ESP8266
+    if (_mode == PM_PC)
+    {
+        timer1_disable();
+        timer1_detachInterrupt();
+    }
+#endif
+
+    duration = millis() - _start;
+    _mode = PM_Off;
+}
+
+void IRAM_ATTR Profiler::sample(uint32_t pc)
+{
+    samples++;
+
+    pc &= ~((1UL << PROFILE_GRAIN) - 1);
+    uint32_t i = (pc >> PROFILE_GRAIN) % PROFILE_SLOTS;
+    for (int k = 0; k < PROFILE_SLOTS; k++)
+    {
+        Slot &slot = _slots[i];
+        if (slot.pc == pc)
+        {
+            slot.count++;
+            return;
+        }
+
+        if (slot.pc == 0)
+        {
+            slot.pc = pc;
+            slot.count = 1;
+            return;
+        }
+
+        i = (i + 1) % PROFILE_SLOTS; // linear probing
+    }
+
+    lost++;
+}
+
+int Profiler::sortSlots()
+{
+    if (_lastMode != PM_PC || _slots == NULL || _mode != PM_Off)
+        return 0;
+
+    // insertion sort by count, descending. Free slots (count 0) end up last
+    for (int i = 1; i < PROFILE_SLOTS; i++)
+    {
+        Slot slot = _slots[i];
+        int j = i - 1;
+        while (j >= 0 && _slots[j].count < slot.count)
+        {
+            _slots[j + 1] = _slots[j];
+            j--;
+        }
+        _slots[j + 1] = slot;
+    }
+
+    int n = 0;
+    while (n < PROFILE_SLOTS && _slots[n].count > 0)
+        n++;
+    return n;
+}
+
+void Profiler::release()
+{
+    if (_mode == PM_PC)
+        return;
+
+    free(_slots);
+    _slots = NULL;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define PROFILE_HZ 1000        // PC sampling rate
+#define PROFILE_SLOTS 128      // PC histogram slots (open addressing), allocated during the run only
+#define PROFILE_GRAIN 4        // PC histogram granularity (bits), i.e., 16 bytes of code per slot
+#define PROFILE_TAGS 32        // Tag mode accounting slots
+#define PROFILE_SENSORS 8      // Sensors with a read tag, the later ones are not timed in tag mode
+#define PROFILE_MAX_SECS 300   // Max run duration
+#define PROFILE_REPORT 48      // Max PC slots in the report (the hottest)
+
+// Tag mode accounting slots
+enum ProfileTag
+{
+    PT_ACTION = 0,  // JTimer callback, PT_ACTION + action ID
+    PT_SENSOR = 16, // Sensor read, PT_SENSOR + sensor ID (below PROFILE_SENSORS)
+    PT_LOOP = PT_SENSOR + PROFILE_SENSORS, // EspClient::loop() iteration, and its phases below
+    PT_TIMERS,
+    PT_ACQUIRE,
+    PT_DRAIN,
+    PT_OTA
+};
+
+static_assert(PT_OTA < PROFILE_TAGS, "Profile tags do not fit PROFILE_TAGS");
+
+enum ProfileMode
+{
+    PM_Off = 0,
+    PM_PC,  // sample the program counter from the timer1 interrupt (ESP8266 only)
+    PM_Tag  // time the JTimer actions, sensor reads and loop phases
+};
+
+/*
+On-demand profiler started by the /cmd/profile command for a limited duration.
+PC mode counts the interrupted program counter per 16 bytes of code in a fixed hash table,
+symbolized on the host against the firmware ELF (tools/profile_symbolize.py). Code running
+with interrupts disabled is not sampled.
+Tag mode accumulates the count and time (us) per tag, e.g., a timer action or a sensor read.
+NOTE: PC mode uses timer1, it must not run together with analogWrite/tone/Servo.
+*/
+class Profiler
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static Profiler &instance();
+    ~Profiler() {};
+
+    struct Slot
+    {
+        uint32_t pc;    // first address of the 16 bytes of code, 0 if free
+        uint32_t count; // number of samples
+    };
+
+    struct Tag
+    {
+        uint32_t count;
+        uint64_t us;
+    };
+
+    bool start(ProfileMode mode); // false if the mode is not supported or out of memory
+    void stop();                  // stop sampling, the results are kept until the next start()
+
+    ProfileMode mode() const { return _mode; };
+    ProfileMode lastMode() const { return _lastMode; }; // mode of the last run, kept after stop()
+    bool isTagging() const { return _mode == PM_Tag; };
+
+    // Account the time of a tag in tag mode, no-op otherwise
+    void tag(uint8_t tag, uint32_t us)
+    {
+        if (_mode == PM_Tag && tag < PROFILE_TAGS)
+        {
+            _tags[tag].count++;
+            _tags[tag].us += us;
+        }
+    };
+
+    void sample(uint32_t pc); // from the timer interrupt
+
+    // Results of the last run
+    int sortSlots();                         // sort the PC slots by count, return the number used
+    void release();                          // free the PC slots once reported
+    const Slot &slot(int i) const { return _slots[i]; };
+    const Tag &tagAt(int i) const { return _tags[i]; };
+    uint32_t samples = 0;        // PC samples taken
+    uint32_t lost = 0;           // PC samples not counted, the table is full
+    unsigned long duration = 0;  // ms
+    uint16_t run = 0;            // run number, identifies the report parts
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    Profiler() {};
+    Profiler(const Profiler &) = delete;            // deleting copy constructor.
+    Profiler &operator=(const Profiler &) = delete; // deleting copy operator.
+
+    volatile ProfileMode _mode = PM_Off;
+    ProfileMode _lastMode = PM_Off;
+    unsigned long _start = 0;
+
+    Slot *_slots = NULL;
+    Tag _tags[PROFILE_TAGS];
+};
@@ -0,0 +1,163 @@
+#include "Resolver.hpp"
+#include "Clock.hpp"
+#include "Crc32.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+#include <time.h>
+#include <lwip/dns.h>
+#ifdef ESP32
+#include <lwip/tcpip.h>
+
+RTC_NOINIT_ATTR static uint32_t _rtcSaved[4];
+#endif
+
+Resolver &Resolver::instance()
+{
+    static Resolver _instance;
+    return _instance;
+}
+
+void Resolver::begin(const char *host, uint32_t ttl)
+{
+    _host = host;
+    _hostCrc = crc32Update(0, (const uint8_t *)host, strlen(host));
+    _ttl = ttl;
+
+    IPAddress ip;
+    _literal = ip.fromString(host);
+    if (_literal)
+    {
+        _ip = ip;
+        return;
+    }
+
+    Saved saved;
+#ifdef ESP8266
+    if (!ESP.rtcUserMemoryRead(RESOLVER_RTC_OFFSET, (uint32_t *)&saved, sizeof(saved)))
+        return;
+#elif defined(ESP32)
+    memcpy(&saved, _rtcSaved, sizeof(saved));
+#endif
+
+    // RTC memory is random after power up, and the entry may belong to a former broker
+    if (saved.magic != RESOLVER_RTC_MAGIC || saved.host != _hostCrc || saved.ip == 0)
+        return;
+
+    _ip = saved.ip;
+    _epoch = saved.epoch;
+    Serial.printf("Broker %s: cached %s\n", host, address().toString().c_str());
+}
+
+bool Resolver::expired() const
+{
+    if (_literal)
+        return false;
+
+    if (_resolved != 0)
+        return millis() - _resolved > _ttl * 1000UL;
+
+    // restored from RTC memory: aged by the clock if synced then and now, unknown otherwise
+    if (_epoch > EPOCH_VALID && clockSynced())
+        return (uint32_t)time(nullptr) - _epoch > _ttl;
+    return true;
+}
+
+bool Resolver::lookup()
+{
+    if (_literal || _host.length() == 0)
+        return false;
+    if (_state == LS_Pending)
+        return true;
+
+    lookups++;
+    _startUs = micros();
+    _state = LS_Pending;
+
+    // the query runs in the lwIP context, the answer comes in _onFound()
+#ifdef ESP8266
+    _query(this);
+#elif defined(ESP32)
+    if (tcpip_callback(_query, this) != ERR_OK)
+        _onFound(NULL, NULL, this);
+#endif
+    return true;
+}
+
+// Loop context on ESP8266, lwIP thread on ESP32
+void Resolver::_query(void *arg)
+{
+    Resolver *self = (Resolver *)arg;
+    ip_addr_t addr;
+
+    err_t err = dns_gethostbyname(self->_host.c_str(), &addr, _onFound, self);
+    if (err == ERR_OK) // in the lwIP cache
+        _onFound(NULL, &addr, self);
+    else if (err != ERR_INPROGRESS)
+        _onFound(NULL, NULL, self);
+}
+
+// lwIP callback (SYS context): keep it short, poll() does the rest
+void Resolver::_onFound(const char *name, const ip_addr_t *addr, void *arg)
+{
+    Resolver *self = (Resolver *)arg;
+    if (self->_state != LS_Pending) // answer after the timeout
+        return;
+
+    self->_endUs = micros();
+    self->_answer = addr != NULL ? ip_addr_get_ip4_u32(addr) : 0;
+    self->_state = self->_answer != 0 ? LS_Found : LS_Failed;
+}
+
+LookupState Resolver::poll()
+{
+    LookupState state = _state;
+
+    if (state == LS_Pending)
+    {
+        if (micros() - _startUs <= RESOLVER_TIMEOUT * 1000)
+            return state;
+
+        _endUs = micros();
+        _answer = 0;
+        state = LS_Failed;
+    }
+    else if (state == LS_Idle)
+    {
+        return state;
+    }
+
+    _state = LS_Idle;
+    lastUs = _endUs - _startUs;
+    Metrics::instance().resolve.add(lastUs);
+
+    if (state == LS_Found)
+    {
+        if (_answer != _ip)
+            changes++;
+        _ip = _answer;
+        _resolved = millis();
+        _epoch = clockSynced() ? time(nullptr) : 0;
+        _save();
+    }
+    else
+    {
+        failures++;
+    }
+
+    Serial.printf("Broker %s: %s %s in %lu ms\n", _host.c_str(), state == LS_Found ? "resolved" : "lookup failed, keeping",
+                  address().toString().c_str(), lastUs / 1000);
+    TRACE(EV_RESOLVE, state, lastUs, _ip);
+    return state;
+}
+
+void Resolver::_save()
+{
+    Saved saved = {RESOLVER_RTC_MAGIC, _hostCrc, _ip, _epoch};
+
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(RESOLVER_RTC_OFFSET, (uint32_t *)&saved, sizeof(saved));
+#elif defined(ESP32)
+    memcpy(_rtcSaved, &saved, sizeof(saved));
+#endif
+}
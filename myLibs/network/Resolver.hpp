@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lwip/ip_addr.h>
+
+#define RESOLVER_TTL 3600            // Default time to live of the cached broker address (s)
+#define RESOLVER_TIMEOUT 8e3         // A lookup without answer for this long failed, mDNS can be slow
+#define RESOLVER_RTC_OFFSET 36       // RTC user memory offset (4 byte blocks), after MemGuard
+#define RESOLVER_RTC_MAGIC 0x31534E44 // "DNS1"
+
+enum LookupState
+{
+    LS_Idle = 0,
+    LS_Pending, // query sent, waiting for the answer
+    LS_Found,   // answered, address() updated
+    LS_Failed   // no answer or not found, the cached address is kept
+};
+
+/*
+Broker address cache. Resolving raspberrypi.local goes through mDNS, slow and flaky on
+consumer routers, so the last resolved address is kept in RTC memory (survives a software
+reset) and the connect attempts go to it first. The name is looked up again in the background
+(non-blocking lwIP query, mDNS for .local names) when the entry is older than the TTL or when
+a connect attempt to it failed. An IP address configured as is needs no lookup.
+The age of an entry restored after a restart is only known once NTP synced, until then it is
+used and refreshed at the first occasion.
+*/
+class Resolver
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static Resolver &instance();
+    ~Resolver() {};
+
+    // Set the broker host name, restore its cached address from RTC memory
+    void begin(const char *host, uint32_t ttl = RESOLVER_TTL);
+
+    bool lookup();       // start a background lookup unless one is pending, false if it cannot start
+    LookupState poll();  // state of the last lookup, LS_Found/LS_Failed are returned once then LS_Idle
+    bool pending() const { return _state == LS_Pending; };
+
+    bool hasAddress() const { return _ip != 0; };
+    IPAddress address() const { return IPAddress(_ip); };
+    bool literal() const { return _literal; };
+    bool expired() const; // older than the TTL, or age unknown
+
+    uint32_t lookups = 0;  // lookups started
+    uint32_t failures = 0; // lookups failed or timed out
+    uint32_t changes = 0;  // lookups that found another address than the cached one
+    uint32_t lastUs = 0;   // duration of the last completed lookup
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    Resolver() {};
+    Resolver(const Resolver &) = delete;            // deleting copy constructor.
+    Resolver &operator=(const Resolver &) = delete; // deleting copy operator.
+
+    // Cache entry in RTC memory
+    struct Saved
+    {
+        uint32_t magic; // RESOLVER_RTC_MAGIC if valid
+        uint32_t host;  // CRC-32 of the host name the address belongs to
+        uint32_t ip;
+        uint32_t epoch; // resolved at (s since 1970), 0 if the time was not synced
+    };
+
+    String _host;
+    uint32_t _hostCrc = 0;
+    uint32_t _ttl = RESOLVER_TTL;
+    bool _literal = false;
+
+    uint32_t _ip = 0;             // cached address, 0 if none
+    uint32_t _epoch = 0;          // see Saved
+    unsigned long _resolved = 0;  // millis() of the lookup in this run, 0 if restored
+
+    // written by the lwIP callback (SYS context), read in loop()
+    volatile LookupState _state = LS_Idle;
+    volatile uint32_t _answer = 0;
+    volatile uint32_t _endUs = 0;
+    uint32_t _startUs = 0;
+
+    static void _query(void *arg);
+    static void _onFound(const char *name, const ip_addr_t *addr, void *arg);
+    void _save();
+};
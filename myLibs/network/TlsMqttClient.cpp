@@ -0,0 +1,324 @@
+#include "TlsMqttClient.hpp"
+
+#ifdef MQTT_TLS
+
+#include <LittleFS.h>
+#include <time.h>
+
+#include "Clock.hpp"
+#include "Crc32.hpp"
+#include "Trace.hpp"
+
+static_assert(TLS_RTC_OFFSET * 4 + sizeof(uint32_t) * 2 + sizeof(BearSSL::Session) <= 512, "TLS session does not fit the RTC user memory");
+
+static const BearSSL::Session EMPTY_SESSION;
+
+// PubSubClient state to the AsyncMqttClient reason
+static AsyncMqttClientDisconnectReason reasonOf(int state)
+{
+    switch (state)
+    {
+    case MQTT_CONNECT_BAD_PROTOCOL:
+        return AsyncMqttClientDisconnectReason::MQTT_UNACCEPTABLE_PROTOCOL_VERSION;
+    case MQTT_CONNECT_BAD_CLIENT_ID:
+        return AsyncMqttClientDisconnectReason::MQTT_IDENTIFIER_REJECTED;
+    case MQTT_CONNECT_UNAVAILABLE:
+        return AsyncMqttClientDisconnectReason::MQTT_SERVER_UNAVAILABLE;
+    case MQTT_CONNECT_BAD_CREDENTIALS:
+        return AsyncMqttClientDisconnectReason::MQTT_MALFORMED_CREDENTIALS;
+    case MQTT_CONNECT_UNAUTHORIZED:
+        return AsyncMqttClientDisconnectReason::MQTT_NOT_AUTHORIZED;
+    default:
+        return AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+    }
+}
+
+TlsMqttClient::TlsMqttClient()
+{
+    char id[16];
+    snprintf(id, sizeof(id), "esp8266-%06x", ESP.getChipId()); // same as AsyncMqttClient
+    _clientId = id;
+
+    _secure.setSession(&_session);
+    _secure.setTimeout(TLS_TIMEOUT * 1000);
+
+    _mqtt.setClient(_secure);
+    _mqtt.setBufferSize(TLS_MQTT_PACKET);
+    _mqtt.setSocketTimeout(TLS_TIMEOUT);
+    _mqtt.setCallback([this](char *topic, uint8_t *payload, unsigned int length)
+                      {
+        if (_onMessage)
+        {
+            AsyncMqttClientMessageProperties properties = {0, false, false};
+            _onMessage(topic, (char *)payload, properties, length, 0, length);
+        } });
+}
+
+TlsMqttClient &TlsMqttClient::onConnect(AsyncMqttClientInternals::OnConnectUserCallback callback)
+{
+    _onConnect = callback;
+    return *this;
+}
+
+TlsMqttClient &TlsMqttClient::onDisconnect(AsyncMqttClientInternals::OnDisconnectUserCallback callback)
+{
+    _onDisconnect = callback;
+    return *this;
+}
+
+TlsMqttClient &TlsMqttClient::onSubscribe(AsyncMqttClientInternals::OnSubscribeUserCallback callback)
+{
+    _onSubscribe = callback;
+    return *this;
+}
+
+// PubSubClient has no unsubscribe acknowledgement, never called
+TlsMqttClient &TlsMqttClient::onUnsubscribe(AsyncMqttClientInternals::OnUnsubscribeUserCallback callback)
+{
+    _onUnsubscribe = callback;
+    return *this;
+}
+
+TlsMqttClient &TlsMqttClient::onMessage(AsyncMqttClientInternals::OnMessageUserCallback callback)
+{
+    _onMessage = callback;
+    return *this;
+}
+
+// Messages are published with QoS 0, not acknowledged, never called
+TlsMqttClient &TlsMqttClient::onPublish(AsyncMqttClientInternals::OnPublishUserCallback callback)
+{
+    _onPublish = callback;
+    return *this;
+}
+
+TlsMqttClient &TlsMqttClient::setServer(const char *host, uint16_t port)
+{
+    _host = host;
+    _ip = IPAddress();
+    _port = port;
+    _restoreSession();
+    return *this;
+}
+
+// Address of the host name set before (Resolver cache), the session stays the one of the host
+TlsMqttClient &TlsMqttClient::setServer(IPAddress ip, uint16_t port)
+{
+    _ip = ip;
+    _port = port;
+    return *this;
+}
+
+TlsMqttClient &TlsMqttClient::setCredentials(const char *username, const char *password)
+{
+    _user = username;
+    _pass = password != nullptr ? password : "";
+    return *this;
+}
+
+void TlsMqttClient::setTrust(const char *fingerprint, const char *caFile)
+{
+    if (LittleFS.exists(caFile))
+    {
+        File file = LittleFS.open(caFile, "r");
+        String pem = file.readString();
+        file.close();
+
+        _pCA = new BearSSL::X509List(pem.c_str());
+        if (_pCA->getCount() > 0)
+        {
+            _secure.setTrustAnchors(_pCA);
+            Serial.printf("TLS: %u CA certificate(s) from %s\n", _pCA->getCount(), caFile);
+            return;
+        }
+
+        delete _pCA;
+        _pCA = NULL;
+        Serial.printf("TLS: no certificate in %s\n", caFile);
+    }
+
+    if (fingerprint != nullptr && fingerprint[0] != '\0' && _secure.setFingerprint(fingerprint))
+    {
+        Serial.println(F("TLS: broker certificate pinned by fingerprint"));
+        return;
+    }
+
+    _secure.setInsecure();
+    Serial.println(F("TLS: WARNING broker not authenticated, no CA file nor fingerprint"));
+}
+
+void TlsMqttClient::connect()
+{
+    if (_mqtt.connected())
+        return;
+
+    if (!_handshake())
+    {
+        _lost(_secure.getLastSSLError() == BR_ERR_X509_NOT_TRUSTED ? AsyncMqttClientDisconnectReason::TLS_BAD_FINGERPRINT
+                                                                  : AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+        return;
+    }
+
+    // the TLS connection is up, PubSubClient only sends CONNECT on it
+    bool ok = _user.length() > 0 ? _mqtt.connect(_clientId.c_str(), _user.c_str(), _pass.c_str())
+                                 : _mqtt.connect(_clientId.c_str());
+    if (!ok)
+    {
+        _secure.stop();
+        _lost(reasonOf(_mqtt.state()));
+        return;
+    }
+
+    _connected = true;
+    _announce = true;
+}
+
+void TlsMqttClient::disconnect(bool force)
+{
+    _mqtt.disconnect();
+    if (force)
+        _secure.stop();
+    _lost(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+}
+
+void TlsMqttClient::loop()
+{
+    if (!_connected)
+        return;
+
+    if (!_mqtt.loop()) // keep alive failed, or the broker closed the connection
+    {
+        _lost(reasonOf(_mqtt.state()));
+        return;
+    }
+
+    // events after connect()/subscribe() returned, as with AsyncMqttClient
+    if (_announce)
+    {
+        _announce = false;
+        if (_onConnect)
+            _onConnect(false);
+    }
+
+    if (_subscribed != 0)
+    {
+        uint16_t packetId = _subscribed;
+        _subscribed = 0;
+        if (_onSubscribe)
+            _onSubscribe(packetId, _subscribedQos);
+    }
+}
+
+uint16_t TlsMqttClient::publish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length,
+                                bool dup, uint16_t message_id)
+{
+    if (payload == nullptr)
+        payload = "";
+    if (length == 0)
+        length = strlen(payload);
+
+    if (!_mqtt.publish(topic, (const uint8_t *)payload, length, retain))
+        return 0;
+    return _nextId();
+}
+
+uint16_t TlsMqttClient::subscribe(const char *topic, uint8_t qos)
+{
+    qos = min(qos, (uint8_t)1); // PubSubClient subscribes with QoS 0 or 1
+    if (!_mqtt.subscribe(topic, qos))
+        return 0;
+
+    _subscribed = _nextId();
+    _subscribedQos = qos;
+    return _subscribed;
+}
+
+// TLS connection, the session offered for resumption. Blocking.
+bool TlsMqttClient::_handshake()
+{
+    bool byName = _pCA != NULL || !_ip.isSet(); // the CA checks the certificate name
+
+    // max fragment length: probed once, the 16KB record buffer is a third of the free heap
+    if (_mfln < 0)
+        _mfln = byName ? BearSSL::WiFiClientSecure::probeMaxFragmentLength(_host.c_str(), _port, TLS_FRAGMENT)
+                       : BearSSL::WiFiClientSecure::probeMaxFragmentLength(_ip, _port, TLS_FRAGMENT);
+    _secure.setBufferSizes(_mfln > 0 ? TLS_FRAGMENT : TLS_FRAGMENT_MAX, TLS_TX_BUFFER);
+
+    // certificate validity, build time of the core until NTP synced
+    if (_pCA != NULL && clockSynced())
+        _secure.setX509Time(time(nullptr));
+
+    BearSSL::Session offered = _session;
+    uint32_t start = micros();
+    // by name the address comes from the lwIP cache, kept fresh by Resolver
+    int ok = byName ? _secure.connect(_host.c_str(), _port) : _secure.connect(_ip, _port);
+    uint32_t us = micros() - start;
+
+    if (!ok)
+    {
+        tlsErrors++;
+        char error[64];
+        int code = _secure.getLastSSLError(error, sizeof(error));
+        Serial.printf("TLS: handshake failed in %lu ms, %d %s\n", us / 1000, code, error);
+        TRACE(EV_TLS, 0, us, code);
+        _mfln = -1; // probe again, the broker may have been unreachable
+        return false;
+    }
+
+    // a resumed session has the same parameters (ID, master secret) as the offered one
+    bool resumed = memcmp(&offered, &EMPTY_SESSION, sizeof(offered)) != 0 && memcmp(&offered, &_session, sizeof(offered)) == 0;
+    (resumed ? resumedHandshake : fullHandshake).add(us);
+    Serial.printf("TLS: %s handshake in %lu ms, buffer %u\n", resumed ? "resumed" : "full", us / 1000,
+                  _mfln > 0 ? TLS_FRAGMENT : TLS_FRAGMENT_MAX);
+    TRACE(EV_TLS, resumed ? 2 : 1, us, 0);
+
+    if (!resumed)
+        _saveSession();
+    return true;
+}
+
+void TlsMqttClient::_lost(AsyncMqttClientDisconnectReason reason)
+{
+    _connected = false;
+    _announce = false;
+    _subscribed = 0;
+    if (_onDisconnect)
+        _onDisconnect(reason);
+}
+
+uint16_t TlsMqttClient::_nextId()
+{
+    if (++_packetId == 0) // 0 means failed
+        _packetId = 1;
+    return _packetId;
+}
+
+uint32_t TlsMqttClient::_hostCrc()
+{
+    return crc32Update(0, (const uint8_t *)_host.c_str(), _host.length());
+}
+
+void TlsMqttClient::_saveSession()
+{
+    Saved saved;
+    saved.magic = TLS_RTC_MAGIC;
+    saved.host = _hostCrc();
+    saved.session = _session;
+    ESP.rtcUserMemoryWrite(TLS_RTC_OFFSET, (uint32_t *)&saved, sizeof(saved));
+}
+
+// RTC memory survives a software reset and deep sleep, not a power cycle
+void TlsMqttClient::_restoreSession()
+{
+    Saved saved;
+    if (!ESP.rtcUserMemoryRead(TLS_RTC_OFFSET, (uint32_t *)&saved, sizeof(saved)))
+        return;
+
+    if (saved.magic == TLS_RTC_MAGIC && saved.host == _hostCrc())
+    {
+        _session = saved.session;
+        Serial.println(F("TLS: session restored"));
+    }
+}
+
+#endif
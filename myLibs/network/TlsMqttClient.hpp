@@ -0,0 +1,115 @@
+#pragma once
+
+// MQTT over TLS, built with -D MQTT_TLS (see the d1_mini_tls environment), ESP8266 only
+#ifdef MQTT_TLS
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h> // callback and reason types, the client API is the same
+#include <WiFiClientSecure.h>
+#include <PubSubClient.h>
+
+#include "Metrics.hpp"
+
+#define TLS_FRAGMENT 2048         // TLS receive buffer if the broker accepts the max fragment length extension
+#define TLS_FRAGMENT_MAX 16384    // TLS receive buffer otherwise (the TLS record size)
+#define TLS_TX_BUFFER 512         // TLS send buffer, a queued message fits
+#define TLS_MQTT_PACKET 384       // MQTT packet buffer, topic and payload of a MqttQueue message
+#define TLS_TIMEOUT 5             // Socket timeout (s)
+#define TLS_CA_FILE "/ca.pem"     // Broker CA certificate(s) on LittleFS, verifies the broker name
+#define TLS_RTC_OFFSET 40         // RTC user memory offset (4 byte blocks) of the session, after Resolver
+#define TLS_RTC_MAGIC 0x31534C54  // "TLS1"
+
+#ifndef ESP8266
+#error "MQTT_TLS needs the BearSSL session API of the ESP8266 core"
+#endif
+
+/*
+Drop-in replacement of AsyncMqttClient (the subset EspClient and MqttQueue use) over a BearSSL
+TLS connection, with PubSubClient for the MQTT protocol.
+A full TLS handshake takes seconds on an ESP8266, so the session parameters are kept in RTC
+memory (survives software resets and deep sleep) and offered again on the next connect: the
+broker resumes the session by its ID and the handshake skips the key exchange. The receive
+buffer is bounded to TLS_FRAGMENT when the broker negotiates the max fragment length (probed
+once), instead of the 16KB TLS record. Handshake times, full and resumed, are on /metrics.
+The broker is authenticated by the CA on LittleFS (TLS_CA_FILE), else by the certificate
+SHA-1 fingerprint of the config, else not at all (a warning is printed).
+Unlike AsyncMqttClient, connect() blocks for the handshake, loop() must be called from the main
+loop, and messages are published with QoS 0 (TCP keeps them in order).
+*/
+class TlsMqttClient
+{
+public:
+    TlsMqttClient();
+    ~TlsMqttClient() {};
+
+    TlsMqttClient &onConnect(AsyncMqttClientInternals::OnConnectUserCallback callback);
+    TlsMqttClient &onDisconnect(AsyncMqttClientInternals::OnDisconnectUserCallback callback);
+    TlsMqttClient &onSubscribe(AsyncMqttClientInternals::OnSubscribeUserCallback callback);
+    TlsMqttClient &onUnsubscribe(AsyncMqttClientInternals::OnUnsubscribeUserCallback callback);
+    TlsMqttClient &onMessage(AsyncMqttClientInternals::OnMessageUserCallback callback);
+    TlsMqttClient &onPublish(AsyncMqttClientInternals::OnPublishUserCallback callback);
+
+    TlsMqttClient &setServer(const char *host, uint16_t port);
+    TlsMqttClient &setServer(IPAddress ip, uint16_t port);
+    TlsMqttClient &setCredentials(const char *username, const char *password = nullptr);
+
+    // Broker authentication: CA file on LittleFS if present, else the fingerprint (hex, e.g., "AB:CD:..")
+    void setTrust(const char *fingerprint, const char *caFile = TLS_CA_FILE);
+
+    void connect();
+    void disconnect(bool force = false);
+    bool connected() { return _mqtt.connected(); };
+    void loop(); // keep alive, incoming messages, events
+
+    uint16_t publish(const char *topic, uint8_t qos, bool retain, const char *payload = nullptr, size_t length = 0,
+                     bool dup = false, uint16_t message_id = 0);
+    uint16_t subscribe(const char *topic, uint8_t qos);
+
+    Histogram fullHandshake;    // handshake time, new session
+    Histogram resumedHandshake; // handshake time, session resumed
+    uint32_t tlsErrors = 0;     // failed handshakes
+
+private:
+    // Session kept in RTC memory
+    struct Saved
+    {
+        uint32_t magic; // TLS_RTC_MAGIC if valid
+        uint32_t host;  // CRC-32 of the broker host name the session belongs to
+        BearSSL::Session session;
+    };
+
+    BearSSL::WiFiClientSecure _secure;
+    BearSSL::Session _session;
+    BearSSL::X509List *_pCA = NULL;
+    PubSubClient _mqtt;
+
+    String _host;
+    IPAddress _ip;
+    uint16_t _port = 8883;
+    String _user;
+    String _pass;
+    String _clientId;
+    int8_t _mfln = -1; // max fragment length accepted by the broker, -1 not probed yet
+
+    bool _connected = false;     // connected, onDisconnect pending on a loss
+    bool _announce = false;      // onConnect to call in loop()
+    uint16_t _packetId = 0;
+    uint16_t _subscribed = 0;    // packet ID of the subscribe to acknowledge in loop(), 0 if none
+    uint8_t _subscribedQos = 0;
+
+    AsyncMqttClientInternals::OnConnectUserCallback _onConnect;
+    AsyncMqttClientInternals::OnDisconnectUserCallback _onDisconnect;
+    AsyncMqttClientInternals::OnSubscribeUserCallback _onSubscribe;
+    AsyncMqttClientInternals::OnUnsubscribeUserCallback _onUnsubscribe;
+    AsyncMqttClientInternals::OnMessageUserCallback _onMessage;
+    AsyncMqttClientInternals::OnPublishUserCallback _onPublish;
+
+    bool _handshake();
+    void _lost(AsyncMqttClientDisconnectReason reason);
+    uint16_t _nextId();
+    uint32_t _hostCrc();
+    void _saveSession();
+    void _restoreSession();
+};
+
+#endif
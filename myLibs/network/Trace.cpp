@@ -0,0 +1,108 @@
+#include "Trace.hpp"
+#include "Clock.hpp"
+
+#include <FS.h>
+#include <LittleFS.h>
+
+#ifdef ESP8266
+#include <user_interface.h>
+#endif
+
+Trace &Trace::instance()
+{
+    static Trace _instance;
+    return _instance;
+}
+
+void Trace::_add(TraceEvent id, uint8_t n, const uint32_t *args)
+{
+    // Events may be recorded from callbacks, reserve the slot atomically
+    noInterrupts();
+    TraceRecord &record = _records[_head];
+    _head = (_head + 1) % TRACE_SIZE;
+    if (_count < TRACE_SIZE)
+        _count++;
+    interrupts();
+
+    record.us = micros();
+    record.id = id;
+    record.n = n;
+    record.reserved = 0;
+    memcpy(record.args, args, n * sizeof(uint32_t));
+}
+
+size_t Trace::dumpSize()
+{
+    return sizeof(TraceHeader) + _count * sizeof(TraceRecord);
+}
+
+void Trace::_header(TraceHeader &header, uint16_t count)
+{
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(TraceRecord);
+    header.count = count;
+    header.now = micros();
+    header.epoch = clockSynced() ? time(NULL) : 0;
+}
+
+size_t Trace::dump(uint8_t *buffer, size_t size)
+{
+    if (size < sizeof(TraceHeader))
+        return 0;
+
+    uint16_t count = _count;
+    uint16_t first = (_head + TRACE_SIZE - count) % TRACE_SIZE;
+    if (sizeof(TraceHeader) + count * sizeof(TraceRecord) > size)
+    {
+        // keep the latest records
+        uint16_t fit = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+        first = (first + count - fit) % TRACE_SIZE;
+        count = fit;
+    }
+
+    TraceHeader header;
+    _header(header, count);
+
+    memcpy(buffer, &header, sizeof(header));
+    size_t n = sizeof(header);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        memcpy(buffer + n, &_records[(first + i) % TRACE_SIZE], sizeof(TraceRecord));
+        n += sizeof(TraceRecord);
+    }
+
+    return n;
+}
+
+bool Trace::save(const char *path)
+{
+    File file = LittleFS.open(path, "w");
+    if (!file)
+        return false;
+
+    // write record by record, no heap allocation (this may run from the crash handler)
+    uint16_t count = _count;
+    uint16_t first = (_head + TRACE_SIZE - count) % TRACE_SIZE;
+
+    TraceHeader header;
+    _header(header, count);
+    file.write((const uint8_t *)&header, sizeof(header));
+
+    for (uint16_t i = 0; i < count; i++)
+        file.write((const uint8_t *)&_records[(first + i) % TRACE_SIZE], sizeof(TraceRecord));
+
+    file.close();
+    return true;
+}
+
+#ifdef ESP8266
+// Called by the core after an exception or a watchdog reset, before the restart
+extern "C" void custom_crash_callback(struct rst_info *rst_info, uint32_t stack, uint32_t stack_end)
+{
+    Trace &trace = Trace::instance();
+    trace.add(EV_CRASH, rst_info->exccause, rst_info->epc1, rst_info->excvaddr, rst_info->depc);
+
+    if (trace.saveOnCrash)
+        trace.save();
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include "TraceEvents.h"
+
+#define TRACE_SIZE 64               // Number of records in the RAM ring buffer
+#define TRACE_FILE "/trace.bin"     // Trace mirrored on LittleFS at restart (and crash if enabled)
+#define TRACE_SLOW_US 50000         // Timer actions and loop iterations slower than this (us) are traced
+
+// Record a trace event, e.g., TRACE(EV_MQTT_DROP, pri, size)
+#define TRACE(id, ...) Trace::instance().add(id, ##__VA_ARGS__)
+
+/*
+Deferred-formatting trace log. A record is the event ID and its raw arguments, kept in a RAM
+ring buffer (the oldest are overwritten). Formatting is done on the host by tools/trace_decode.cpp
+from the dump served on /api/trace or sent on <module>/trace by the /cmd/trace command.
+Recording costs a micros() call and a few stores, it is always on.
+*/
+class Trace
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static Trace &instance();
+    ~Trace() {};
+
+    template <typename... Args>
+    void add(TraceEvent id, Args... args)
+    {
+        static_assert(sizeof...(args) <= TRACE_MAX_ARGS, "Too many trace arguments");
+        uint32_t words[] = {0, _word(args)...};
+        _add(id, sizeof...(args), words + 1);
+    }
+
+    size_t dumpSize();                       // size of the binary dump
+    size_t dump(uint8_t *buffer, size_t size); // binary dump: header and records from the oldest
+    bool save(const char *path = TRACE_FILE);  // write the dump to LittleFS
+
+    bool saveOnCrash = false; // mirror the trace to LittleFS from the crash handler (ESP8266, best effort)
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    Trace() {};
+    Trace(const Trace &) = delete;            // deleting copy constructor.
+    Trace &operator=(const Trace &) = delete; // deleting copy operator.
+
+    TraceRecord _records[TRACE_SIZE];
+    uint16_t _head = 0;  // next record to write
+    uint16_t _count = 0; // number of records kept
+
+    void _add(TraceEvent id, uint8_t n, const uint32_t *args);
+    void _header(TraceHeader &header, uint16_t count);
+
+    static uint32_t _word(float value)
+    {
+        uint32_t word;
+        memcpy(&word, &value, sizeof(word));
+        return word;
+    };
+    static uint32_t _word(double value) { return _word((float)value); };
+    template <typename T>
+    static uint32_t _word(T value) { return (uint32_t)value; };
+};
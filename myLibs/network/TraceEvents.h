@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+Trace event table shared by the firmware and the host decoder (tools/trace_decode.cpp).
+TRACE_EVENT(ID, "format"): arguments are recorded as raw 32-bit words and formatted on the host,
+a %f argument is recorded as float bits. Up to TRACE_MAX_ARGS arguments, no strings.
+The ID is the position in the table: append new events at the end only.
+*/
+
+#define TRACE_MAX_ARGS 4
+
+#define TRACE_EVENTS                                                                  \
+    TRACE_EVENT(EV_BOOT, "boot: reset reason %u")                                     \
+    TRACE_EVENT(EV_WIFI_UP, "wifi: got ip %u.%u.%u.%u")                               \
+    TRACE_EVENT(EV_WIFI_DOWN, "wifi: disconnected, reason %u")                        \
+    TRACE_EVENT(EV_MQTT_TRY, "mqtt: connecting, try %u")                              \
+    TRACE_EVENT(EV_MQTT_UP, "mqtt: connected")                                        \
+    TRACE_EVENT(EV_MQTT_DOWN, "mqtt: disconnected, reason %u")                        \
+    TRACE_EVENT(EV_MQTT_DROP, "mqtt: message dropped, priority %u, queue %u")         \
+    TRACE_EVENT(EV_NTP_SYNC, "ntp: synced, epoch %u")                                 \
+    TRACE_EVENT(EV_READ_FAIL, "sensor %u: read failed in %u us")                      \
+    TRACE_EVENT(EV_ALARM, "sensor %u: channel %u alarm state %u, value %.2f")         \
+    TRACE_EVENT(EV_CYCLE, "sensor %u: pump cycle %u, drop %.1f, %u s")                \
+    TRACE_EVENT(EV_SLOW_ACTION, "timer: action %u took %u us")                        \
+    TRACE_EVENT(EV_SLOW_LOOP, "loop: iteration took %u us")                           \
+    TRACE_EVENT(EV_RESTART, "restart: code %u")                                       \
+    TRACE_EVENT(EV_CRASH, "crash: exception %u, epc1 0x%08x, excvaddr 0x%08x, depc 0x%08x") \
+    TRACE_EVENT(EV_MEM_LEVEL, "memory: level %u, heap %u, block %u") \
+    TRACE_EVENT(EV_OTA, "ota: state %u, %u of %u bytes") \
+    TRACE_EVENT(EV_CONNECT, "connect: stage %u, next attempt in %u ms") \
+    TRACE_EVENT(EV_RESOLVE, "resolve: state %u in %u us, address 0x%08x") \
+    TRACE_EVENT(EV_TLS, "tls: handshake %u (0 failed, 1 full, 2 resumed) in %u us, error %u")
+
+enum TraceEvent
+{
+#define TRACE_EVENT(id, format) id,
+    TRACE_EVENTS
+#undef TRACE_EVENT
+    EV_COUNT
+};
+
+// Binary dump layout (little endian), header followed by the records from the oldest
+#define TRACE_MAGIC "TRC1"
+
+struct TraceHeader
+{
+    char magic[4];       // TRACE_MAGIC
+    uint16_t recordSize; // sizeof(TraceRecord)
+    uint16_t count;      // number of records
+    uint32_t now;        // micros() at dump
+    uint32_t epoch;      // time() at dump, 0 if NTP not synched
+};
+
+struct TraceRecord
+{
+    uint32_t us;    // micros() at record time
+    uint16_t id;    // TraceEvent
+    uint8_t n;      // number of arguments
+    uint8_t reserved;
+    uint32_t args[TRACE_MAX_ARGS];
+};
@@ -0,0 +1,53 @@
+#include "alarm.hpp"
+
+void Alarm::reset(float low, float high, float hyst, float rate)
+{
+    _low = low;
+    _high = high;
+    _hyst = isnan(hyst) ? 0 : hyst;
+    _rate = rate;
+
+    _hasLast = false;
+    state = AS_Normal;
+}
+
+bool Alarm::check(double measure, unsigned long now)
+{
+    AlarmState last = state;
+
+    // rate of change per minute since the last measure
+    float rate = 0;
+    if (_hasLast && now != _lastTime)
+        rate = (measure - _last) * 60000.0 / (now - _lastTime);
+
+    _hasLast = true;
+    _last = measure;
+    _lastTime = now;
+
+    // Once tripped, a low/high alarm only clears after the measure moves back by the hysteresis
+    if (!isnan(_low) && (measure < _low || (last == AS_Low && measure < _low + _hyst)))
+        state = AS_Low;
+    else if (!isnan(_high) && (measure > _high || (last == AS_High && measure > _high - _hyst)))
+        state = AS_High;
+    else if (!isnan(_rate) && fabs(rate) > _rate)
+        state = AS_Rate;
+    else
+        state = AS_Normal;
+
+    return state != last;
+}
+
+const char *Alarm::stateName(AlarmState state)
+{
+    switch (state)
+    {
+    case AS_Low:
+        return "low";
+    case AS_High:
+        return "high";
+    case AS_Rate:
+        return "rate";
+    default:
+        return "normal";
+    }
+}
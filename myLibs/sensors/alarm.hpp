@@ -0,0 +1,40 @@
+#pragma once
+
+#include <math.h>
+
+enum AlarmState
+{
+    AS_Normal = 0, // Within limits
+    AS_Low = 1,    // Below the low threshold
+    AS_High = 2,   // Above the high threshold
+    AS_Rate = 3    // Changing faster than the rate-of-change limit
+};
+
+/*
+ * Alarm: threshold and rate-of-change rule of one measure channel.
+ * Limits set to NAN are disabled.
+ */
+class Alarm
+{
+public:
+    Alarm() {};
+    virtual ~Alarm() {};
+
+    // low/high: thresholds, hyst: hysteresis to clear a low/high alarm, rate: max change per minute
+    void reset(float low, float high, float hyst, float rate);
+
+    AlarmState state = AS_Normal;                 // current alarm state
+    bool check(double measure, unsigned long now); // check the new (filtered) measure, return true if the state changed
+
+    static const char *stateName(AlarmState state);
+
+private:
+    float _low = NAN;
+    float _high = NAN;
+    float _hyst = 0;
+    float _rate = NAN;
+
+    bool _hasLast = false;
+    float _last = 0;              // last measure, used for rate of change
+    unsigned long _lastTime = 0; // time (ms) of the last measure
+};
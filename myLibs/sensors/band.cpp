@@ -1,53 +1,68 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <math.h>
 #include "band.hpp"
 
-void Band::reset(BandType type, uint16_t gap, bool pct)
+void Band::reset(BandType type, float gap, bool pct, float hyst, unsigned long minInterval, unsigned long maxSilence)
 {
     _type = type;
     _gap = gap;
     _pct = pct;
 
+    _hyst = hyst;
+    _minInterval = minInterval;
+    _maxSilence = maxSilence;
+
     _last = 0;
+    _dir = 0;
+    _reported = false;
 }
 
-bool Band::check(double measure)
+bool Band::check(double measure, unsigned long now)
 {
     status = false;
 
     if (_type == BT_None || _last == 0)
     {
-        _last = measure;
         status = true;
     }
+    else
+    {
+        float delta = measure - _last;
+        float gap = _pct ? _last * _gap / 100.0 : _gap;
 
-    float gap = _pct ? _last * _gap / 100.0 : _gap;
-    float delta = abs(measure - _last);
+        // Reversing the direction of the last reported change needs the hysteresis on top of the gap,
+        // so a value sitting at the edge of the gap does not flicker.
+        if ((delta > 0 && _dir < 0) || (delta < 0 && _dir > 0))
+            gap += _hyst;
 
-    if (delta == 0)
-    {
-        if (_type == BandType::Deadband0 || _type == BandType::Narrowband0)
-        {
-            _last = measure;
-            status = true;
-        }
-    }
-    else if (delta > gap)
-    {
-        if (_type == BandType::Deadband0 || _type == BandType::Deadband1)
-        {
-            _last = measure;
-            status = true;
-        }
+        delta = fabs(delta);
+
+        if (delta == 0)
+            status = (_type == BandType::Deadband0 || _type == BandType::Narrowband0);
+        else if (delta > gap)
+            status = (_type == BandType::Deadband0 || _type == BandType::Deadband1);
+        else if (delta < gap)
+            status = (_type == BandType::Narrowband0 || _type == BandType::Narrowband1);
     }
-    else if (delta < gap)
+
+    // Hold back the report if it is too soon after the last one
+    if (status && _reported && _minInterval > 0 && now - _lastReport < _minInterval)
+        status = false;
+
+    // Force a report after the max silence, so a flat signal still tells the device is alive
+    if (!status && _reported && _maxSilence > 0 && now - _lastReport >= _maxSilence)
+        status = true;
+
+    if (status)
     {
-        if (_type == BandType::Narrowband0 || _type == BandType::Narrowband1)
-        {
-            _last = measure;
-            status = true;
-        }
+        if (measure != _last)
+            _dir = measure > _last ? 1 : -1;
+
+        _last = measure;
+        _lastReport = now;
+        _reported = true;
     }
 
     return status;
-}
\ No newline at end of file
+}
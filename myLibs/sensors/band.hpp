@@ -16,14 +16,25 @@ public:
     Band() {};
     virtual ~Band() {};
 
-    void reset(BandType type, uint16_t gap, bool pct);
+    // hyst: extra gap needed to reverse the direction of the last reported change
+    // minInterval: min time (ms) between two reports, 0 to disable
+    // maxSilence: max time (ms) without a report, a report is forced when exceeded. 0 to disable
+    void reset(BandType type, float gap, bool pct, float hyst = 0, unsigned long minInterval = 0, unsigned long maxSilence = 0);
 
-    bool status = false;		// indicate this measure is to go
-    bool check(double measure); // abstract function, check if need pass the measure.
+    bool status = false;		                     // indicate this measure is to go
+    bool check(double measure, unsigned long now); // check if need pass the measure. now: current time in ms
 
 private:
     BandType _type = BT_None;
-    uint16_t _gap = 0;
+    float _gap = 0;
     bool _pct = 0;	 // percentage or fixed value
     float _last = 0; // old value
-};
\ No newline at end of file
+
+    float _hyst = 0;
+    int _dir = 0; // direction of the last reported change: 1 up, -1 down, 0 unknown
+
+    unsigned long _minInterval = 0;
+    unsigned long _maxSilence = 0;
+    unsigned long _lastReport = 0; // time (ms) of the last report
+    bool _reported = false;        // if any measure has been reported
+};
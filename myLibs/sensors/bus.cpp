@@ -0,0 +1,95 @@
+#include "bus.hpp"
+
+MeasureBus &MeasureBus::instance()
+{
+    static MeasureBus _instance;
+    return _instance;
+}
+
+void MeasureBus::publish(const char *sensor, const char *channel, float value, unsigned long ms)
+{
+    Entry *pEntry = NULL;
+    for (int i = 0; i < _count; i++)
+    {
+        // names are not copied, so the same sensor and channel give the same pointers
+        if (_entries[i].sensor == sensor && _entries[i].channel == channel)
+        {
+            pEntry = &_entries[i];
+            break;
+        }
+    }
+
+    if (pEntry == NULL)
+    {
+        if (_count == BUS_SIZE)
+        {
+            Serial.printf("Bus full: %s/%s\n", sensor, channel);
+            return;
+        }
+
+        pEntry = &_entries[_count++];
+        pEntry->sensor = sensor;
+        pEntry->channel = channel;
+    }
+
+    pEntry->value = value;
+    pEntry->ms = ms;
+
+    if (_listener)
+        _listener(*pEntry);
+}
+
+bool MeasureBus::read(const char *key, float &value, unsigned long maxAge)
+{
+    Entry *pEntry = _find(key);
+    if (pEntry == NULL || isnan(pEntry->value))
+        return false;
+
+    if (maxAge > 0 && millis() - pEntry->ms > maxAge)
+        return false;
+
+    value = pEntry->value;
+    return true;
+}
+
+MeasureBus::Entry *MeasureBus::_find(const char *key)
+{
+    const char *slash = strchr(key, '/');
+    for (int i = 0; i < _count; i++)
+    {
+        Entry &entry = _entries[i];
+        if (slash == NULL)
+        {
+            if (strcmp(entry.channel, key) == 0)
+                return &entry;
+        }
+        else if (strncmp(entry.sensor, key, slash - key) == 0 && entry.sensor[slash - key] == '\0' &&
+                 strcmp(entry.channel, slash + 1) == 0)
+        {
+            return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+void AirSource::reset(const char *temp, const char *humi, unsigned long stale, float fallbackTemp, float fallbackHumi)
+{
+    strncpy(_temp, temp, sizeof(_temp) - 1);
+    strncpy(_humi, humi, sizeof(_humi) - 1);
+    _stale = stale;
+    _fallbackTemp = fallbackTemp;
+    _fallbackHumi = fallbackHumi;
+}
+
+float AirSource::temperature()
+{
+    float value;
+    return MeasureBus::instance().read(_temp, value, _stale) ? value : _fallbackTemp;
+}
+
+float AirSource::humidity()
+{
+    float value;
+    return MeasureBus::instance().read(_humi, value, _stale) ? value : _fallbackHumi;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+
+#define BUS_SIZE 16 // Max number of channels on the bus
+
+/*
+Shared in-memory measurement bus. Every sensor publishes the latest (filtered) value
+of its channels here after each successful measure, and any other sensor can read it,
+e.g., SR04 reads the air temperature from the DHT11 on the same device.
+It is also the latest-value cache served locally by the web portal, reading it never
+triggers a sensor read.
+Channels are looked up by "<sensor>/<channel>", e.g., "dh11/temperature", or by the
+bare channel name, e.g., "temperature", which matches the first sensor having it.
+*/
+class MeasureBus
+{
+    // Singleton design (e.g., private constructor)
+public:
+    static MeasureBus &instance();
+    ~MeasureBus() {};
+
+    struct Entry
+    {
+        const char *sensor;
+        const char *channel;
+        float value;
+        unsigned long ms; // time (ms since boot) of the measure
+    };
+
+    typedef std::function<void(const Entry &entry)> Listener;
+    void onPublish(Listener listener) { _listener = listener; }; // called on each new value, e.g., live view
+
+    // sensor and channel names are not copied, they must outlive the bus (sensor name and static channel names)
+    void publish(const char *sensor, const char *channel, float value, unsigned long ms);
+
+    // Latest value of the channel, false if not found or older than maxAge (ms, 0 for no limit)
+    bool read(const char *key, float &value, unsigned long maxAge = 0);
+
+    int size() const { return _count; };
+    const Entry &entry(int index) const { return _entries[index]; };
+
+private:
+    // Singleton design pattern required
+    // https://stackoverflow.com/questions/448056/c-singleton-getinstance-return
+    MeasureBus() {};
+    MeasureBus(const MeasureBus &) = delete;            // deleting copy constructor.
+    MeasureBus &operator=(const MeasureBus &) = delete; // deleting copy operator.
+
+    Entry _entries[BUS_SIZE];
+    int _count = 0;
+    Listener _listener = NULL;
+
+    Entry *_find(const char *key);
+};
+
+/*
+Ambient air conditions for the distance sensors, read from the bus with a staleness
+limit. The fallback values are used when the source is missing or stale.
+*/
+class AirSource
+{
+public:
+    void reset(const char *temp, const char *humi, unsigned long stale, float fallbackTemp, float fallbackHumi);
+
+    float temperature(); // Celsius
+    float humidity();    // %RH
+
+private:
+    char _temp[40] = "temperature"; // bus key of the air temperature
+    char _humi[40] = "humidity";    // bus key of the relative humidity
+    unsigned long _stale = 300e3;   // max age (ms) of the readings
+    float _fallbackTemp = 24.0;
+    float _fallbackHumi = 50.0;
+};
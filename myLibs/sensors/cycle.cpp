@@ -0,0 +1,85 @@
+#include "cycle.hpp"
+
+void CycleDetector::reset(float startRate, float stopRate)
+{
+    _startRate = startRate;
+    _stopRate = stopRate;
+
+    _samples.clear();
+    _cycle = Cycle();
+    _hasStop = false;
+    _confirm = 0;
+    state = CS_Fill;
+}
+
+bool CycleDetector::check(float measure, unsigned long now)
+{
+    _samples.push({now, measure});
+    if (!_samples.isFull())
+        return false;
+
+    float level;
+    float slope = _slope(level);
+
+    bool change = state == CS_Fill ? slope > _startRate : slope < _stopRate;
+    _confirm = change ? _confirm + 1 : 0;
+    if (_confirm < CYCLE_CONFIRM)
+        return false;
+
+    _confirm = 0;
+
+    // The slope lags half a window behind the last sample
+    unsigned long time = (_samples[0].time + now) / 2;
+
+    if (state == CS_Fill)
+    {
+        state = CS_Pump;
+
+        // Level rise rate of the fill just ended (distance goes down while filling)
+        _cycle.fill = _hasStop && time != _stopTime ? (_stopLevel - level) * 60000.0 / (time - _stopTime) : NAN;
+        _cycle.start = time;
+        _startLevel = level;
+    }
+    else
+    {
+        state = CS_Fill;
+
+        _cycle.stop = time;
+        _cycle.drop = level - _startLevel;
+        _cycle.count++;
+
+        _hasStop = true;
+        _stopTime = time;
+        _stopLevel = level;
+
+        return true;
+    }
+
+    return false;
+}
+
+float CycleDetector::_slope(float &mean) const
+{
+    int n = _samples.size();
+
+    // time relative to the oldest sample (s) to keep the float precision
+    float tm = 0, vm = 0;
+    for (int i = 0; i < n; i++)
+    {
+        tm += (_samples[i].time - _samples[0].time) / 1000.0;
+        vm += _samples[i].value;
+    }
+    tm /= n;
+    vm /= n;
+
+    float stv = 0, stt = 0;
+    for (int i = 0; i < n; i++)
+    {
+        float dt = (_samples[i].time - _samples[0].time) / 1000.0 - tm;
+        stv += dt * (_samples[i].value - vm);
+        stt += dt * dt;
+    }
+
+    mean = vm;
+    return stt > 0 ? stv / stt * 60 : 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <math.h>
+#include "ring.hpp"
+
+#define CYCLE_WINDOW 32  // Number of recent samples the slope is estimated on
+#define CYCLE_CONFIRM 10 // Number of consecutive samples confirming a pump start/stop
+
+enum CycleState
+{
+    CS_Fill = 0, // pump off, pit filling
+    CS_Pump = 1  // pump on, pit draining
+};
+
+// A completed pump cycle
+struct Cycle
+{
+    unsigned long start = 0; // pump start time (ms)
+    unsigned long stop = 0;  // pump stop time (ms)
+    float drop = 0;          // distance the level dropped while pumping
+    float fill = NAN;        // fill rate (per minute) before the pump started, NAN if unknown
+    unsigned long count = 0; // number of cycles since boot
+};
+
+/*
+ * Pump cycle detector on a high-rate distance signal (sensor above the water).
+ * The slope over the recent samples is estimated by least squares. The pump is on while
+ * the distance grows faster than the start rate, and off again once it slows below the stop rate.
+ * A start/stop needs to hold for CYCLE_CONFIRM samples in a row, so noise does not trip it.
+ */
+class CycleDetector
+{
+public:
+    CycleDetector() {};
+    virtual ~CycleDetector() {};
+
+    // startRate/stopRate: distance change per minute to detect the pump start/stop
+    void reset(float startRate, float stopRate);
+
+    CycleState state = CS_Fill;
+    bool check(float measure, unsigned long now); // add a sample, return true when a cycle is completed
+    const Cycle &last() const { return _cycle; }; // the last completed cycle
+
+private:
+    struct Sample
+    {
+        unsigned long time; // ms
+        float value;
+    };
+
+    RingBuffer<Sample, CYCLE_WINDOW> _samples;
+
+    float _startRate = 30;
+    float _stopRate = 10;
+    int _confirm = 0; // consecutive samples suggesting a state change
+
+    Cycle _cycle;               // the cycle in progress / last completed
+    float _startLevel = 0;      // distance when the pump started
+    bool _hasStop = false;      // if a previous stop is known
+    unsigned long _stopTime = 0; // time (ms) of the previous stop
+    float _stopLevel = 0;       // distance at the previous stop
+
+    float _slope(float &mean) const; // slope (per minute) and mean of the samples in the window
+};
@@ -1,45 +1,35 @@
 #include "dht11.hpp"
 
+// Measure channel names
+static const char *const CHANNELS[] = {"humidity", "temperature", "temperature_f", "heatindex_f", "heatindex"};
+
 // dhtPin: Digital pin connected to the DHT sensor
 DH11::DH11(const char *name, uint8_t dhtPin)
     : Sensor(name, 5, FT_None), _dht(dhtPin, DHT11)
 {
+    _channels = CHANNELS;
+    _active = 0x03; // humidity and temperature, the derived channels are computed only if enabled in config
     _dht.begin();
 }
 
-// Generate MQTT message payload based on current measurement
+// Generate MQTT message payload based on current measurement, active channels passing the band only
 char *DH11::getPayload()
 {
-    static char payload[100];
-    char tmp[30];
-    // snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"humidity\":%.1f,\"temperature\":%.1f,\"heatindex\":%.1f}",
-    // 	_timestamp*1000,
-    // 	_measures[0],
-    // 	_measures[1],
-    // 	_measures[4]);
-
-    if (!_bands[0]->status && !_bands[1]->status)
-        return NULL;
-
-    // snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"humidity\":%.1f,\"temperature\":%.1f}",
-    //   _timestamp,
-    // 	_measures[0],
-    // 	_measures[1]);
+    static char payload[200];
 
-    snprintf(payload, sizeof(payload), "{\"timestamp\":%lld", _timestamp);
+    int n = _stamp(payload, sizeof(payload));
+    int n0 = n;
 
-    if (_bands[0]->status)
+    for (int i = 0; i < _nMeasures; i++)
     {
-        snprintf(tmp, sizeof(tmp), ",\"humidity\":%.1f", _measures[0]);
-        strcat(payload, tmp);
+        if (isActive(i) && _bands[i]->status)
+            n += snprintf(payload + n, sizeof(payload) - n, ",\"%s\":%.1f", CHANNELS[i], _measures[i]);
     }
 
-    if (_bands[1]->status)
-    {
-        snprintf(tmp, sizeof(tmp), ",\"temperature\":%.1f}", _measures[1]);
-        strcat(payload, tmp);
-    }
+    if (n == n0)
+        return NULL;
 
+    snprintf(payload + n, sizeof(payload) - n, "}");
     return payload;
 }
 
@@ -51,13 +41,16 @@ bool DH11::_read()
     // Base class Sensor::measure() will shift the _index automatically
     static float h, t, f;
 
+    // Fahrenheit and heat indices are computed only if active, it is all soft-float
+    bool needF = isActive(2) || isActive(3);
+
     // Reading temperature or humidity takes about 250 milliseconds!
     // Sensor readings may also be up to 2 seconds 'old' (its a very slow sensor)
     h = _dht.readHumidity();
     // Read temperature as Celsius (the default)
     t = _dht.readTemperature();
     // Read temperature as Fahrenheit (isFahrenheit = true)
-    f = _dht.readTemperature(true);
+    f = needF ? _dht.readTemperature(true) : 0;
 
     // Check if any reads failed and exit early (to try again).
     if (isnan(h) || isnan(t) || isnan(f))
@@ -68,16 +61,16 @@ bool DH11::_read()
         return false;
     }
 
-    // Compute heat index in Fahrenheit (the default)
-    float hif = _dht.computeHeatIndex(f, h);
-    // Compute heat index in Celsius (isFahreheit = false)
-    float hic = _dht.computeHeatIndex(t, h, false);
-
     _measures[0] = h;
     _measures[1] = t;
     _measures[2] = f;
-    _measures[3] = hif;
-    _measures[4] = hic;
+
+    // Compute heat index in Fahrenheit (the default)
+    if (isActive(3))
+        _measures[3] = _dht.computeHeatIndex(f, h);
+    // Compute heat index in Celsius (isFahreheit = false)
+    if (isActive(4))
+        _measures[4] = _dht.computeHeatIndex(t, h, false);
 
     return true;
 }
@@ -0,0 +1,143 @@
+#include "fusion.hpp"
+
+#define VAR_INIT 1.0   // initial variance of a source
+#define VAR_MIN 0.01   // variance floor, so a single source can't take all the weight
+#define VAR_LAMBDA 0.1 // weight of the new residual in the running variance
+
+// Measure channel names
+static const char *const CHANNELS[] = {"distance"};
+
+// Sources are filtered already, no filter on the fused value
+Fusion::Fusion(const char *name, float tolerance)
+    : Sensor(name, 1, FT_None)
+{
+    _channels = CHANNELS;
+    _tolerance = tolerance;
+}
+
+bool Fusion::addSource(Sensor *pSensor, int index)
+{
+    if (_nSources == MAX_SOURCES)
+        return false;
+
+    _sources[_nSources++] = {pSensor, index, VAR_INIT, 0, false, false};
+
+    // The source is measured by this fusion from now on
+    pSensor->setSource(true);
+    return true;
+}
+
+char *Fusion::getPayload()
+{
+    static char payload[180];
+
+    if (!_bands[0]->status)
+        return NULL;
+
+    int n = _stamp(payload, sizeof(payload));
+    snprintf(payload + n, sizeof(payload) - n, ",\"distance\":%.1f,\"confidence\":%.2f,\"sources\":%d}",
+             _measures[0], _confidence, _nUsed);
+    _appendTank(payload, sizeof(payload), _measures[0]);
+    return payload;
+}
+
+bool Fusion::_read()
+{
+    // Measure all sources. An invalid read (e.g., SR04 echo timeout, VL53 phase failure) has no confidence.
+    int nValid = 0;
+    float values[MAX_SOURCES];
+    for (int i = 0; i < _nSources; i++)
+    {
+        Source &src = _sources[i];
+        src.valid = src.pSensor->measure() && src.pSensor->getConfidence() > 0;
+        src.used = src.valid;
+        if (src.valid)
+        {
+            src.value = src.pSensor->getMeasure(src.index);
+            values[nValid++] = src.value;
+        }
+    }
+
+    if (nValid == 0)
+        return false;
+
+    // Consensus: with 3+ sources, reject the ones too far from the median.
+    // With 2 sources disagreeing, keep the one with the lower variance per confidence.
+    if (nValid >= 3)
+    {
+        // insertion sort, there are only a few sources
+        for (int i = 1; i < nValid; i++)
+        {
+            for (int j = i; j > 0 && values[j - 1] > values[j]; j--)
+            {
+                float v = values[j];
+                values[j] = values[j - 1];
+                values[j - 1] = v;
+            }
+        }
+        float median = values[nValid / 2];
+
+        for (int i = 0; i < _nSources; i++)
+        {
+            if (_sources[i].used && fabs(_sources[i].value - median) > _tolerance)
+                _sources[i].used = false;
+        }
+    }
+    else if (nValid == 2)
+    {
+        Source *pA = NULL, *pB = NULL;
+        for (int i = 0; i < _nSources; i++)
+        {
+            if (!_sources[i].used)
+                continue;
+
+            if (pA == NULL)
+                pA = &_sources[i];
+            else
+                pB = &_sources[i];
+        }
+
+        if (fabs(pA->value - pB->value) > _tolerance)
+        {
+            if (pA->var / pA->pSensor->getConfidence() > pB->var / pB->pSensor->getConfidence())
+                pA->used = false;
+            else
+                pB->used = false;
+        }
+    }
+
+    // Weighted average, weight = confidence / variance
+    float sumW = 0, sumWV = 0, sumC = 0;
+    _nUsed = 0;
+    for (int i = 0; i < _nSources; i++)
+    {
+        Source &src = _sources[i];
+        if (!src.used)
+            continue;
+
+        float w = src.pSensor->getConfidence() / (src.var > VAR_MIN ? src.var : VAR_MIN);
+        sumW += w;
+        sumWV += w * src.value;
+        sumC += src.pSensor->getConfidence();
+        _nUsed++;
+    }
+
+    float fused = sumWV / sumW;
+
+    // Update the running variance of all valid sources against the fused value,
+    // so a source that keeps getting rejected loses weight.
+    for (int i = 0; i < _nSources; i++)
+    {
+        Source &src = _sources[i];
+        if (src.valid)
+        {
+            float residual = src.value - fused;
+            src.var = (1 - VAR_LAMBDA) * src.var + VAR_LAMBDA * residual * residual;
+        }
+    }
+
+    _measures[0] = fused;
+    _confidence = sumC / _nSources; // lower when sources are invalid or rejected
+
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "sensor.hpp"
+
+#define MAX_SOURCES 4 // Max number of source sensors of a fusion
+
+/*
+ * Fusion of redundant distance sensors (e.g., SR04 + VL53L0X in the dual enclosure) into one level.
+ * Sources are weighted by their confidence over their running variance. A source disagreeing with
+ * the consensus by more than the tolerance is rejected.
+ */
+class Fusion : public Sensor
+{
+public:
+    Fusion(const char *name, float tolerance);
+    virtual char *getPayload();
+
+    bool addSource(Sensor *pSensor, int index); // index: measure channel of the source
+
+private:
+    struct Source
+    {
+        Sensor *pSensor;
+        int index;
+        float var;   // running variance of the source against the fused value
+        float value; // latest measure
+        bool valid;  // latest measure is valid
+        bool used;   // used in the latest fusion
+    };
+
+    Source _sources[MAX_SOURCES];
+    int _nSources = 0;
+    int _nUsed = 0; // number of sources used in the latest fusion
+
+    float _tolerance; // max disagreement with the consensus
+
+    virtual bool _read();
+};
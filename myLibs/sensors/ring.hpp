@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * Fixed size ring buffer. Pushing into a full buffer overwrites the oldest item.
+ */
+template <typename T, int N>
+class RingBuffer
+{
+public:
+    void clear()
+    {
+        _head = 0;
+        _count = 0;
+    }
+
+    void push(const T &item)
+    {
+        _items[_head] = item;
+        _head = (_head + 1) % N;
+        if (_count < N)
+            _count++;
+    }
+
+    // Remove the oldest item, return false if empty
+    bool pop(T &item)
+    {
+        if (_count == 0)
+            return false;
+
+        item = (*this)[0];
+        _count--;
+        return true;
+    }
+
+    int size() const { return _count; };
+    bool isEmpty() const { return _count == 0; };
+    bool isFull() const { return _count == N; };
+
+    // The i-th item, 0 is the oldest
+    T &operator[](int i) { return _items[(_head + N - _count + i) % N]; };
+    const T &operator[](int i) const { return _items[(_head + N - _count + i) % N]; };
+
+private:
+    T _items[N];
+    int _head = 0;  // index where the next item goes
+    int _count = 0; // number of items
+};
@@ -0,0 +1,46 @@
+#include "sampler.hpp"
+
+void Sampler::reset(unsigned long interval)
+{
+    _adaptive = false;
+    _minInterval = _maxInterval = this->interval = interval;
+    _hasLast = false;
+}
+
+void Sampler::reset(unsigned long minInterval, unsigned long maxInterval, float rate)
+{
+    _adaptive = true;
+    _minInterval = minInterval;
+    _maxInterval = maxInterval < minInterval ? minInterval : maxInterval;
+    _rate = rate;
+
+    interval = _minInterval; // start fast until the signal is known to be flat
+    _hasLast = false;
+}
+
+void Sampler::start(unsigned long now)
+{
+    _lastStart = now;
+}
+
+void Sampler::update(double measure, unsigned long now)
+{
+    if (_adaptive && _hasLast && now != _lastTime)
+    {
+        float rate = (measure - _last) * 60000.0 / (now - _lastTime);
+
+        // Active if the measure is moving, or its rate of change is (e.g., a fill stops). The change
+        // is relative to an active rate, a flat signal only has noise in it.
+        bool changing = fabs(_lastRate) > _rate && fabs(rate - _lastRate) > SAMPLER_RATE_CHANGE * fabs(_lastRate);
+        if (fabs(rate) > _rate || changing)
+            interval = _minInterval;
+        else if (interval < _maxInterval)
+            interval = interval * 2 < _maxInterval ? interval * 2 : _maxInterval;
+
+        _lastRate = rate;
+    }
+
+    _hasLast = true;
+    _last = measure;
+    _lastTime = now;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <math.h>
+
+#define SAMPLER_RATE 0.5        // Default adaptive rate (change per minute), below it a measure is flat
+#define SAMPLER_RATE_CHANGE 0.5 // Relative change of an active rate of change (e.g., a fill stops) keeping the min interval
+
+/*
+ * Sampler: decides when a sensor is due for the next measure.
+ * Fixed mode samples every interval. Adaptive mode drops to the min interval while the
+ * measure or its rate of change is changing, and doubles the interval (up to the max)
+ * on every flat sample.
+ */
+class Sampler
+{
+public:
+    Sampler() {};
+    virtual ~Sampler() {};
+
+    void reset(unsigned long interval);                                   // fixed interval (ms)
+    void reset(unsigned long minInterval, unsigned long maxInterval, float rate); // adaptive, rate: change per minute considered active
+
+    bool isAdaptive() const { return _adaptive; };
+    bool isDue(unsigned long now) const { return now - _lastStart >= interval; };
+
+    void start(unsigned long now);                 // a measure is started
+    void update(double measure, unsigned long now); // a measure is done, adapt the interval
+
+    unsigned long interval = 2000; // current sampling interval (ms)
+
+private:
+    bool _adaptive = false;
+    unsigned long _minInterval = 2000;
+    unsigned long _maxInterval = 2000;
+    float _rate = NAN;
+
+    unsigned long _lastStart = 0; // time (ms) the last measure started
+
+    bool _hasLast = false;
+    float _last = 0;          // last measure
+    float _lastRate = 0;      // last rate of change (per minute)
+    unsigned long _lastTime = 0; // time (ms) of the last measure
+};
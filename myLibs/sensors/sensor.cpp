@@ -4,7 +4,7 @@
 // nMeasures: number of measures a sensor can generator (some sensor integrates multiple type of measures)
 Sensor::Sensor(const char *sensorName, int nMeasures,
                FilterType filter,
-               BandType band, uint16_t gap, bool pct)
+               BandType band, float gap, bool pct)
 {
     // sizeof: Returns the length of the given byte string, include null terminator;
     // strlen: Returns the length of the given byte string not including null terminator;
@@ -29,6 +29,13 @@ Sensor::Sensor(const char *sensorName, int nMeasures,
 
     setBand(band, gap, pct);
 
+    // init the alarm pointer array, alarms are only created when set
+    _alarms = new Alarm *[_nMeasures];
+    for (int i = 0; i < _nMeasures; i++)
+    {
+        _alarms[i] = NULL;
+    }
+
     // init the measure array
     _measures = (float *)calloc(nMeasures, sizeof(float));
 }
@@ -39,7 +46,24 @@ Sensor::~Sensor()
     {
         if (_filters[i] != NULL)
             delete _filters[i];
+
+        if (_alarms[i] != NULL)
+            delete _alarms[i];
+    }
+
+    if (_detector != NULL)
+        delete _detector;
+
+    if (_tank != NULL)
+        delete _tank;
+
+    for (int i = 0; i < _nWindows; i++)
+    {
+        delete _windows[i];
+        if (_heldWindows[i] != NULL)
+            delete _heldWindows[i];
     }
+    free(_acquired);
 
     free(_measures);
 }
@@ -77,19 +101,19 @@ void Sensor::setFilter(int index, FilterType type)
     }
 }
 
-void Sensor::setBand(BandType type, uint16_t gap, bool pct)
+void Sensor::setBand(BandType type, float gap, bool pct, float hyst, unsigned long minInterval, unsigned long maxSilence)
 {
     for (int i = 0; i < _nMeasures; i++)
     {
-        setBand(i, type, gap, pct);
+        setBand(i, type, gap, pct, hyst, minInterval, maxSilence);
     }
 }
 
-void Sensor::setBand(int index, BandType type, uint16_t gap, bool pct)
+void Sensor::setBand(int index, BandType type, float gap, bool pct, float hyst, unsigned long minInterval, unsigned long maxSilence)
 {
     if (_bands[index] == NULL)
         _bands[index] = new Band();
-    _bands[index]->reset(type, gap, pct);
+    _bands[index]->reset(type, gap, pct, hyst, minInterval, maxSilence);
 
     // if(type == BandType::None)
     // {
@@ -105,17 +129,188 @@ void Sensor::setBand(int index, BandType type, uint16_t gap, bool pct)
     // }
 }
 
+void Sensor::setAlarm(int index, float low, float high, float hyst, float rate)
+{
+    setActive(index, true);
+
+    if (_alarms[index] == NULL)
+        _alarms[index] = new Alarm();
+    _alarms[index]->reset(low, high, hyst, rate);
+}
+
+void Sensor::setInterval(unsigned long interval)
+{
+    _sampler.reset(interval);
+}
+
+void Sensor::setAdaptive(int index, unsigned long minInterval, unsigned long maxInterval, float rate)
+{
+    setActive(index, true);
+    _samplerChannel = index;
+    _sampler.reset(minInterval, maxInterval, rate);
+}
+
+void Sensor::setCycle(int index, float hz, float startRate, float stopRate)
+{
+    if (_detector == NULL)
+    {
+        _detector = new CycleDetector();
+        _acquired = (float *)calloc(_nMeasures, sizeof(float));
+    }
+
+    setActive(index, true);
+    _detectorChannel = index;
+    _acquireInterval = 1000 / hz;
+    _detector->reset(startRate, stopRate);
+}
+
+// High-rate sample for the cycle detector. The raw read is not filtered nor published,
+// only compact per-cycle events are.
+void Sensor::acquire()
+{
+    if (!_enabled || _detector == NULL)
+        return;
+
+    _lastAcquire = millis();
+
+    // _read() writes into _measures, keep the regular (filtered) measures intact
+    memcpy(_acquired, _measures, _nMeasures * sizeof(float));
+    bool ok = _timedRead();
+    float value = _measures[_detectorChannel];
+    memcpy(_measures, _acquired, _nMeasures * sizeof(float));
+
+    if (ok && _detector->check(value, _lastAcquire))
+    {
+        if (clockSynced())
+        {
+            _sendCycle(_detector->last());
+        }
+        else
+        {
+            if (_cycleHeld)
+                Serial.printf("%s: cycle dropped, clock not synced\n", name);
+            _heldCycle = _detector->last();
+            _cycleHeld = true;
+        }
+    }
+}
+
+// Publish the completed cycle, e.g.,
+// {"timestamp":1700000000,"ms":1700000000123,"stop":1700000042,"duration":42310,"drop":21.3,"count":12,"fill":1.8}
+void Sensor::_sendCycle(const Cycle &cycle)
+{
+    char topic[MQTT_TOPIC_LEN];
+    _makeTopic(topic, sizeof(topic), "cycle");
+
+    char payload[160];
+    uint64_t start = _epochMs(cycle.start);
+    uint64_t stop = _epochMs(cycle.stop);
+    int n = snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"ms\":%llu,\"stop\":%lld,\"duration\":%lu,\"drop\":%.1f,\"count\":%lu",
+                     (long long)(start / 1000), (unsigned long long)start, (long long)(stop / 1000),
+                     (unsigned long)(cycle.stop - cycle.start), cycle.drop, cycle.count);
+    if (!isnan(cycle.fill))
+        n += snprintf(payload + n, sizeof(payload) - n, ",\"fill\":%.2f", cycle.fill);
+    snprintf(payload + n, sizeof(payload) - n, "}");
+
+    MqttQueue::instance().push(topic, payload, PRI_MEASURE, 1, false);
+    TRACE(EV_CYCLE, id, cycle.count, cycle.drop, (cycle.stop - cycle.start) / 1000);
+
+#ifdef _DEBUG
+    Serial.printf("%s: %s\n", topic, payload);
+#endif
+}
+
+bool Sensor::addWindow(int index, unsigned long period)
+{
+    if (_nWindows == MAX_WINDOWS)
+    {
+        Serial.printf("%s: too many windows\n", name);
+        return false;
+    }
+
+    setActive(index, true);
+
+    Window *pWindow = new Window();
+    pWindow->reset(index, period, millis());
+    _windows[_nWindows++] = pWindow;
+    return true;
+}
+
+// Publish the window summary, e.g.,
+// {"timestamp":1700000000,"ms":1700000000123,"channel":"distance","window":60,"n":30,"min":50.1,"max":50.9,"mean":50.4,"std":0.21}
+void Sensor::_sendWindow(const Window *pWindow)
+{
+    char topic[MQTT_TOPIC_LEN];
+    _makeTopic(topic, sizeof(topic), "stats");
+
+    char payload[MQTT_PAYLOAD_LEN];
+    uint64_t start = _epochMs(pWindow->start);
+    snprintf(payload, sizeof(payload),
+             "{\"timestamp\":%lld,\"ms\":%llu,\"channel\":\"%s\",\"window\":%lu,\"n\":%lu,\"min\":%.2f,\"max\":%.2f,\"mean\":%.2f,\"std\":%.3f}",
+             (long long)(start / 1000), (unsigned long long)start, channelName(pWindow->index), pWindow->period / 1000, pWindow->count,
+             pWindow->min, pWindow->max, pWindow->mean, pWindow->stddev());
+
+    MqttQueue::instance().push(topic, payload, PRI_MEASURE, 1, false);
+
+#ifdef _DEBUG
+    Serial.printf("%s: %s\n", topic, payload);
+#endif
+}
+
+void Sensor::setTank(Tank *pTank)
+{
+    if (_tank != NULL)
+        delete _tank;
+    _tank = pTank;
+}
+
+// The payload must end with the closing brace, e.g., {"timestamp":1700000000,"ms":1700000000123,"acq":25210,"distance":50.1}
+void Sensor::_appendTank(char *payload, size_t size, float distance)
+{
+    if (_tank == NULL)
+        return;
+
+    size_t n = strlen(payload);
+    if (n == 0 || payload[n - 1] != '}')
+        return;
+
+    snprintf(payload + n - 1, size - n + 1, ",\"gallons\":%.1f,\"percent\":%.1f}", _tank->gallons(distance), _tank->percent(distance));
+}
+
+void Sensor::setActive(int index, bool active)
+{
+    if (active)
+        _active |= 1 << index;
+    else
+        _active &= ~(1 << index);
+}
+
+int Sensor::channelIndex(const char *channel)
+{
+    for (int i = 0; i < _nMeasures; i++)
+    {
+        if (strcmp(channel, channelName(i)) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+const char *Sensor::channelName(int index)
+{
+    return _channels != NULL ? _channels[index] : "value";
+}
+
 // qos :
 //     0: At most once
 //     1: At least once
 //     2: Exactly once
-void Sensor::setMqtt(AsyncMqttClient *pClient, const char *topic, int qos, bool retain)
+void Sensor::setMqtt(const char *module, int qos, bool retain)
 {
-    _pMqttClient = pClient;
+    snprintf(_module, sizeof(_module), "%s", module); // null terminated, even if truncated
 
     // write the default topic of the sensor for mqtt
-    // strcpy(_topic, topic);
-    strncpy(_topic, topic, sizeof(_topic));
+    _makeTopic(_topic, sizeof(_topic), "sensor");
 
     _qos = qos;
     _retain = retain;
@@ -124,8 +319,9 @@ void Sensor::setMqtt(AsyncMqttClient *pClient, const char *topic, int qos, bool
 // Send MQTT measurement message to MQTT broker!
 void Sensor::sendMeasure()
 {
-    // do not do anything if disabled or not connected to network
-    if (!_enabled || _pMqttClient == NULL || !_pMqttClient->connected())
+    // The measure runs whatever the connection state: /api/measure, /api/events, the bus and
+    // the alarms depend on it, e.g., commissioning on WiFi without the broker.
+    if (!_enabled)
         return;
 
     // Accuracy only to 1mm. so output to 1 decimal place.
@@ -135,11 +331,17 @@ void Sensor::sendMeasure()
         return;
     }
 
+    // Routine samples are not queued while the broker is away, except until the clock is synced:
+    // those are held with their monotonic capture time (see MqttQueue::pushStamped()).
+    if (!_raw || (!MqttQueue::instance().connected() && clockSynced()))
+        return;
+
     char *payload = getPayload();
     if (payload == NULL)
         return;
 
-    _pMqttClient->publish(_topic, _qos, _retain, payload); // retain will clear the chart when deploying!! set it to false
+    // retain will clear the chart when deploying!! set it to false
+    MqttQueue::instance().pushStamped(_topic, payload, _stampLen, _startUs, _acqUs, PRI_MEASURE, _qos, _retain);
 
 #ifdef _DEBUG
     Serial.printf("%s: %s\n", _topic, payload); // name, _topic, payload);
@@ -149,19 +351,150 @@ void Sensor::sendMeasure()
 // Perform measurement (unit: cm)
 bool Sensor::measure()
 {
-    if (!_enabled || !_read())
+    if (!_enabled)
+        return false;
+
+    _sampler.start(millis()); // a failed read waits for the next interval as well
+
+    if (!_timedRead())
         return false;
 
-    _timestamp = time(NULL); // get current timestamp
+    // capture time: the start of the acquisition, not the end of a read that may take 250 ms
+    uint64_t ms = epochMs(_startUs);
+    _timestamp = ms > 0 ? ms / 1000 : time(NULL);
+    unsigned long now = millis();
 
     for (int i = 0; i < _nMeasures; i++)
     {
+        // Inactive channels are not computed by _read(), leave them alone
+        if (!isActive(i))
+            continue;
+
         // Get the filtered value if a filter is set.
         if (_filters[i] != NULL)
             _measures[i] = _filters[i]->state(_measures[i]);
 
-        _bands[i]->check(_measures[i]);
+        // Alarm state change is published right away, not waiting for the band
+        if (_alarms[i] != NULL && _alarms[i]->check(_measures[i], now))
+            _sendAlarm(i);
+
+        _bands[i]->check(_measures[i], now);
+
+        // Share the latest value with the other sensors
+        MeasureBus::instance().publish(name, channelName(i), _measures[i], now);
+    }
+
+    _sampler.update(_measures[_samplerChannel], now);
+
+    if (clockSynced())
+        _sendHeld();
+
+    // Aggregation windows: publish the summary when the period is over, then start over
+    for (int i = 0; i < _nWindows; i++)
+    {
+        Window *pWindow = _windows[i];
+        if (pWindow->isDone(now))
+        {
+            if (pWindow->count > 0)
+            {
+                if (clockSynced())
+                {
+                    _sendWindow(pWindow);
+                }
+                else
+                {
+                    if (_heldWindows[i] == NULL)
+                        _heldWindows[i] = new Window();
+                    else
+                        Serial.printf("%s: window dropped, clock not synced\n", name);
+                    *_heldWindows[i] = *pWindow;
+                }
+            }
+            pWindow->restart(now);
+        }
+
+        pWindow->add(_measures[pWindow->index]);
     }
 
     return true;
 }
+
+bool Sensor::_timedRead()
+{
+    uint64_t start = monoUs();
+    bool ok = _read();
+    uint32_t elapsed = monoUs() - start;
+    _startUs = start;
+    _acqUs = elapsed;
+    readTime.add(elapsed);
+    if (id < PROFILE_SENSORS) // the tag range after it is the loop
+        Profiler::instance().tag(PT_SENSOR + id, elapsed);
+
+    if (!ok)
+    {
+        readErrors++;
+        TRACE(EV_READ_FAIL, id, elapsed);
+    }
+    return ok;
+}
+
+// Publish the alarm state as a retained message, so the latest state is always on the broker
+void Sensor::_sendAlarm(int index)
+{
+    char topic[MQTT_TOPIC_LEN];
+    char payload[140];
+
+    _makeTopic(topic, sizeof(topic), "alarm", channelName(index));
+    int n = _stamp(payload, sizeof(payload));
+    snprintf(payload + n, sizeof(payload) - n, ",\"state\":\"%s\",\"value\":%.1f}",
+             Alarm::stateName(_alarms[index]->state), _measures[index]);
+
+    MqttQueue::instance().pushStamped(topic, payload, n, _startUs, _acqUs, PRI_ALARM, 1, true);
+    TRACE(EV_ALARM, id, index, _alarms[index]->state, _measures[index]);
+
+#ifdef _DEBUG
+    Serial.printf("%s: alarm %s\n", topic, payload);
+#endif
+}
+
+void Sensor::_makeTopic(char *topic, size_t size, const char *kind, const char *channel)
+{
+    if (channel == NULL)
+        snprintf(topic, size, "%s/%s/%s", _module, kind, name);
+    else
+        snprintf(topic, size, "%s/%s/%s/%s", _module, kind, name, channel);
+}
+
+// Publish the cycle and window summaries completed before the clock sync
+void Sensor::_sendHeld()
+{
+    if (_cycleHeld)
+    {
+        _sendCycle(_heldCycle);
+        _cycleHeld = false;
+    }
+
+    for (int i = 0; i < _nWindows; i++)
+    {
+        if (_heldWindows[i] != NULL)
+        {
+            _sendWindow(_heldWindows[i]);
+            delete _heldWindows[i];
+            _heldWindows[i] = NULL;
+        }
+    }
+}
+
+uint64_t Sensor::_epochMs(unsigned long ms)
+{
+    return epochMs(monoUs() - (uint64_t)(millis() - ms) * 1000);
+}
+
+// Capture time prefix, see writeStamp(). Its length is kept for MqttQueue::pushStamped(),
+// which rewrites it once the clock is synced.
+int Sensor::_stamp(char *payload, size_t size)
+{
+    int n = writeStamp(payload, size, _startUs, _acqUs);
+    _stampLen = n;
+    return n;
+}
@@ -1,10 +1,21 @@
 #pragma once
 
 #include <time.h>
-#include <AsyncMqttClient.h>
+#include "MqttQueue.hpp"
+#include "Config.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Profiler.hpp"
+#include "Clock.hpp"
 
 #include "filter.hpp"
 #include "band.hpp"
+#include "alarm.hpp"
+#include "sampler.hpp"
+#include "cycle.hpp"
+#include "window.hpp"
+#include "bus.hpp"
+#include "tank.hpp"
 
 /*
  * Base Sensor class for all derived sensor classes, e.g., SR04, DH11, VL53L0X, etc
@@ -14,44 +25,133 @@ class Sensor
 public:
     Sensor(const char *sensorName, int nMeasures,
            FilterType filter = Median,
-           BandType band = BT_None, uint16_t gap = 0, bool pct = false);
+           BandType band = BT_None, float gap = 0, bool pct = false);
 
     void enable(bool enable) { _enabled = enable; };
     bool isEnabled() { return _enabled; };
 
+    void setSource(bool source) { _source = source; }; // used as a fusion source, measured by the fusion only
+    bool isSource() { return _source; };
+
+    float getMeasure(int index) { return _measures[index]; }; // latest (filtered) measure
+    float getConfidence() { return _confidence; };            // confidence (0-1) of the latest read, 0 if invalid
+
     // Returns the measurement in an array (in cm)
     bool measure();
     void setFilter(FilterType type);            // set all filters to the same type
     void setFilter(int index, FilterType type); // set specific filter
 
-    void setBand(BandType type, uint16_t gap, bool pct);            // set all bands to the same type
-    void setBand(int index, BandType type, uint16_t gap, bool pct); // set specific band
+    // set all bands to the same type
+    void setBand(BandType type, float gap, bool pct, float hyst = 0, unsigned long minInterval = 0, unsigned long maxSilence = 0);
+    // set specific band
+    void setBand(int index, BandType type, float gap, bool pct, float hyst = 0, unsigned long minInterval = 0, unsigned long maxSilence = 0);
+
+    void setAlarm(int index, float low, float high, float hyst, float rate); // set alarm rule of specific measure
+
+    bool isDue(unsigned long now) { return _sampler.isDue(now); };      // if the next measure is due
+    bool isAdaptive() { return _sampler.isAdaptive(); };                // if sampling interval is adaptive
+    void setInterval(unsigned long interval);                           // fixed sampling interval (ms)
+    void setAdaptive(int index, unsigned long minInterval, unsigned long maxInterval, float rate); // adaptive sampling driven by the measure
+
+    // High-rate acquisition (hz) of a measure feeding the pump cycle detector
+    void setCycle(int index, float hz, float startRate, float stopRate);
+    bool isAcquireDue(unsigned long now) { return _detector != NULL && now - _lastAcquire >= _acquireInterval; };
+    void acquire(); // take one high-rate sample, leaving the regular measures untouched
+
+    // Air conditions source for the distance sensors, bus keys with staleness limit (ms) and fallbacks
+    void setAir(const char *temp, const char *humi, unsigned long stale, float fallbackTemp, float fallbackHumi)
+    {
+        _air.reset(temp, humi, stale, fallbackTemp, fallbackHumi);
+    };
 
-    void setMqtt(AsyncMqttClient *pClient, const char *topic, int qos = 0, bool retain = false); // set MQTT client
-    void sendMeasure();                                                                          // send measurement using MQTT message
+    void setTank(Tank *pTank); // tank model converting the distance (measure 0) to gallons and percent, owned by the sensor
+
+    bool addWindow(int index, unsigned long period); // aggregate the measure over a rolling window (ms), summary published at the end
+    void setRaw(bool raw) { _raw = raw; };           // publish the raw (filtered) measures or not, e.g., only window summaries
+
+    // Channels are computed, filtered and banded only when active, e.g., consumed by the payload, an alarm or a window.
+    // Setting an alarm, window, adaptive sampling or cycle detection on a channel activates it.
+    void setActive(int index, bool active);
+    bool isActive(int index) { return _active & (1 << index); };
+
+    int channelIndex(const char *channel); // index of the named measure channel, -1 if not found
+    const char *channelName(int index);    // name of the measure channel, e.g., "distance"
+
+    // Topics are <module>/<kind>/<sensor name>, e.g., OilGauge/sensor/sr04, OilGauge/alarm/sr04/distance
+    void setMqtt(const char *module, int qos = 0, bool retain = false); // set MQTT topic
+    void sendMeasure();                                                 // send measurement using MQTT message
     virtual char *getPayload() = 0;
     virtual ~Sensor();
 
     char name[25]; // sensor name
+    uint8_t id = 0; // sensor index in config, identifies the sensor in the trace
+
+    Histogram readTime;      // _read() latency (us)
+    uint32_t readErrors = 0; // failed _read() count
 
 protected:
     // MQTT parameters
-    AsyncMqttClient *_pMqttClient = NULL;
+    char _module[MODULE_LEN] = ""; // module name
+    char _topic[MQTT_TOPIC_LEN]; // mqtt topic of the measures
+    int _qos = 0;                // mqtt qos
+    bool _retain = false;        // mqtt retain
 
-    char _topic[25];      // mqtt topic
-    int _qos = 0;         // mqtt qos
-    bool _retain = false; // mqtt retain
+    void _makeTopic(char *topic, size_t size, const char *kind, const char *channel = NULL); // <module>/<kind>/<name>[/<channel>]
+    uint64_t _epochMs(unsigned long ms);                                                     // convert time (ms since boot) to epoch (ms)
 
-    time_t _timestamp; // timestamp of the current measure
+    // Capture time of the current measure, taken when the acquisition starts
+    time_t _timestamp;     // epoch (s), seconds since boot until the clock is synced
+    uint64_t _startUs = 0; // monoUs() at the start of the last acquisition
+    uint32_t _acqUs = 0;   // duration of the last acquisition (us)
+    uint8_t _stampLen = 0; // length of the capture time prefix of the last payload
+    int _stamp(char *payload, size_t size); // open the payload with the capture time, return its length
 
     // Measurements
     virtual bool _read() = 0; // overload this function to read sensor values
+    bool _timedRead();        // _read() with latency and error accounting
 
     int _nMeasures;
     float *_measures = NULL;  // Save the measures. Filter processed measures are saved here. Length: _nMeasures
+    float _confidence = 1;    // Confidence (0-1) of the latest read, set by _read()
     Filter **_filters = NULL; // Data filter pointer
     Band **_bands = NULL;
+    Alarm **_alarms = NULL; // Alarm rule pointer, NULL if no alarm set on the measure
+
+    const char *const *_channels = NULL; // Measure channel names, set by the derived class. Length: _nMeasures
+    uint8_t _active = 0xFF;              // Active channel mask (bit i for measure i), all by default. Up to 8 channels
+
+    AirSource _air; // Ambient temperature and humidity read from the measurement bus
+
+    Tank *_tank = NULL;                                           // Tank model, NULL if the volume is not published
+    void _appendTank(char *payload, size_t size, float distance); // append ,"gallons":..,"percent":.. before the closing brace
 
 private:
     bool _enabled = true; // If this sensor is enabled
+    bool _source = false; // If this sensor is a fusion source
+
+    Sampler _sampler;         // Sampling schedule
+    int _samplerChannel = 0;  // Index of the measure driving the adaptive sampling
+
+    CycleDetector *_detector = NULL;   // Pump cycle detector, NULL if high-rate mode is off
+    int _detectorChannel = 0;          // Index of the measure feeding the detector
+    unsigned long _acquireInterval = 0; // High-rate sampling interval (ms)
+    unsigned long _lastAcquire = 0;     // Time (ms) of the last high-rate sample
+    float *_acquired = NULL;            // Scratch buffer keeping the regular measures during acquire()
+
+    void _sendCycle(const Cycle &cycle); // publish the completed pump cycle
+
+    Window *_windows[MAX_WINDOWS]; // Aggregation windows
+    int _nWindows = 0;
+    bool _raw = true; // publish the raw measures
+
+    void _sendWindow(const Window *pWindow); // publish the window summary
+
+    // Cycles and window summaries completed before the clock sync, published once synced:
+    // their times are kept in ms since boot and converted then
+    Cycle _heldCycle;
+    bool _cycleHeld = false;
+    Window *_heldWindows[MAX_WINDOWS] = {}; // copy of the completed window, NULL if none held
+    void _sendHeld();
+
+    void _sendAlarm(int index); // publish the alarm state change of the measure immediately
 };
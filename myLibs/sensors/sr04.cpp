@@ -1,16 +1,22 @@
 #include "sr04.hpp"
 
-SR04::SR04(const char *name, uint8_t triggerPin, uint8_t echoPin)
+// Measure channel names
+static const char *const CHANNELS[] = {"distance"};
+
+SR04::SR04(const char *name, uint8_t triggerPin, uint8_t echoPin, float range)
     : Sensor(name, 1, Median)
 {
+    _channels = CHANNELS;
+
     _triggerPin = triggerPin;
     _echoPin = echoPin;
+    _timeout = (range > 0 && range < SR04_RANGE ? range : SR04_RANGE) * SR04_US_PER_CM;
 }
 
 // _timestamp is the one of the lastest measure
 char *SR04::getPayload()
 {
-    static char payload[50];
+    static char payload[140];
     // According to the C standard, unless the buffer size is 0, vsnprintf() and
     // snprintf() null terminates its output. No need to add \0 in its format
     // snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"distance\":%.1f}",
@@ -19,12 +25,14 @@ char *SR04::getPayload()
     if (!_bands[0]->status)
         return NULL;
 
-    snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"distance\":%.1f}", _timestamp, _measures[0]);
+    int n = _stamp(payload, sizeof(payload));
+    snprintf(payload + n, sizeof(payload) - n, ",\"distance\":%.1f}", _measures[0]);
+    _appendTank(payload, sizeof(payload), _measures[0]);
     return payload;
 }
 
 // Measure distance in mm
-// airTemp: the temperature in Celsius
+// The speed of sound is compensated with the air temperature and humidity from the bus
 bool SR04::_read()
 {
     // _index is the current index of 5 measures.
@@ -33,7 +41,9 @@ bool SR04::_read()
     static unsigned duration; // variable for the duration of sound wave travel
     static float soundSpeed;  // variable for the sound speed in the air
 
-    float airTemp = 24.0;
+    // Basements range from 5 to 30 C, i.e., a few percent of the distance
+    float airTemp = _air.temperature();
+    float airHumi = _air.humidity();
 
     // The sensor is triggered by a HIGH pulse of 10 or more microseconds.
     // Give a short LOW pulse beforehand to ensure a clean HIGH pulse:
@@ -49,17 +59,19 @@ bool SR04::_read()
     // of the ping to the reception of its echo off of an object.
     // Reads the PIN_ECHO, returns the sound wave travel time in microseconds
     pinMode(_echoPin, INPUT); // Sets the PIN_ECHO as an INPUT
-    // You can use pulseIn with interrupts active, but results are less accurate.
+    // Interrupts stay on: with high-rate sampling (up to 20 reads/s) masking them for the echo
+    // would starve the WiFi stack. An interrupt during the echo adds a few us of jitter, the median
+    // filter takes care of it. The wait is bounded by the range (e.g., the tank depth).
     // ref: https://www.best-microcontroller-projects.com/arduino-pulsein.html
-    noInterrupts();
-    // For a different timeout use an unsigned long value (in microseconds) for the last parameter.
-    duration = pulseIn(_echoPin, HIGH, 35000UL); // microseconds of (total) sound travel, 1e6 is 1s. timeout: default 1 second.
-    interrupts();
+    duration = pulseIn(_echoPin, HIGH, _timeout); // microseconds of (total) sound travel, 0 if no echo within the timeout
 
     // Calculating the distance
-    soundSpeed = 331300 + 606 * airTemp;        //  mm/s
-    _measures[0] = soundSpeed * duration / 2e7; // cm // Speed of sound wave divided by 2 (go and back)
+    soundSpeed = 331300 + 606 * airTemp + 12.4 * airHumi; //  mm/s
+    _measures[0] = soundSpeed * duration / 2e7;           // cm // Speed of sound wave divided by 2 (go and back)
     // Serial.println(_lastReadings[0][_index]);
 
+    // No echo within the timeout gives 0, the read is invalid
+    _confidence = duration > 0 ? 1.0 : 0;
+
     return _measures[0] > 1e-3; // must be something, otherwise it is not connected
 }
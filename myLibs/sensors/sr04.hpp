@@ -2,19 +2,23 @@
 
 #include "sensor.hpp"
 
+#define SR04_RANGE 400    // Max distance (cm), the sensor limit
+#define SR04_US_PER_CM 66 // Echo round trip per cm of distance (us), sound at 0 C plus 10% margin
+
 /*
  * SR04 Ultrasonic distance sensor class
  */
 class SR04 : public Sensor
 {
 public:
-    SR04(const char *name, uint8_t triggerPin, uint8_t echoPin);
+    SR04(const char *name, uint8_t triggerPin, uint8_t echoPin, float range = SR04_RANGE); // range: max distance (cm), bounds the echo wait
     virtual char *getPayload();
 
 private:
     // sensor pins
     uint8_t _triggerPin;
     uint8_t _echoPin;
+    unsigned long _timeout; // echo wait (us)
 
     virtual bool _read();
 };
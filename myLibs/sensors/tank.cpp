@@ -0,0 +1,152 @@
+#include "tank.hpp"
+
+void Tank::reset(TankShape shape, float height, float width, float length, float offset, float capacity)
+{
+    _shape = shape;
+    _height = height;
+    _width = width;
+    _length = length;
+    _offset = offset;
+    _capacity = capacity;
+    _nCal = 0;
+}
+
+bool Tank::addCalibration(float distance, float gallons)
+{
+    if (_nCal == TANK_MAX_CAL)
+        return false;
+
+    // keep the points sorted by level, i.e., decreasing distance
+    int i = _nCal++;
+    while (i > 0 && _calDistance[i - 1] < distance)
+    {
+        _calDistance[i] = _calDistance[i - 1];
+        _calGallons[i] = _calGallons[i - 1];
+        i--;
+    }
+
+    _calDistance[i] = distance;
+    _calGallons[i] = gallons;
+    return true;
+}
+
+TankShape Tank::shapeOf(const char *name)
+{
+    if (strcmp(name, "horizontal") == 0)
+        return TS_Horizontal;
+    if (strcmp(name, "oval") == 0)
+        return TS_Oval;
+    return TS_Vertical;
+}
+
+float Tank::_segment(float r, float h)
+{
+    return r * r * acos((r - h) / r) - (r - h) * sqrt(2 * r * h - h * h);
+}
+
+float Tank::_area(float level)
+{
+    switch (_shape)
+    {
+    case TS_Horizontal:
+        return _segment(_height / 2, level);
+
+    case TS_Oval:
+    {
+        float r = _width / 2;
+        float full = PI * r * r + _width * (_height - _width);
+        if (level <= r)
+            return _segment(r, level);
+        if (level >= _height - r)
+            return full - _segment(r, _height - level);
+        return PI * r * r / 2 + _width * (level - r);
+    }
+
+    default: // the side view of a vertical tank is a rectangle
+        return _width * level;
+    }
+}
+
+// All the float math (acos, sqrt) is done here once at boot
+void Tank::build()
+{
+    float full = _area(_height);
+    for (int i = 0; i <= TANK_SEGMENTS; i++)
+        _lut[i] = 65535 * _area(_height * i / TANK_SEGMENTS) / full + 0.5;
+
+    if (_capacity <= 0)
+    {
+        if (_shape == TS_Vertical)
+            full = _length > 0 ? _width * _length : PI * _width * _width / 4; // footprint area
+        _capacity = (_shape == TS_Vertical ? full * _height : full * _length) / CM3_PER_GAL;
+    }
+
+    _scale = 256.0 * TANK_SEGMENTS / _height;
+
+    if (_nCal == 0 || _capacity <= 0)
+        return;
+
+    // Correct the table by the calibration error, interpolated over the level and held beyond the end points
+    float error[TANK_MAX_CAL];
+    float level[TANK_MAX_CAL];
+    for (int k = 0; k < _nCal; k++)
+    {
+        level[k] = _height + _offset - _calDistance[k];
+        error[k] = _calGallons[k] / _capacity - _fraction(_calDistance[k]) / 65535.0;
+    }
+
+    uint16_t prev = 0;
+    for (int i = 0; i <= TANK_SEGMENTS; i++)
+    {
+        float h = _height * i / TANK_SEGMENTS;
+        float e = error[0];
+        if (h >= level[_nCal - 1])
+        {
+            e = error[_nCal - 1];
+        }
+        else
+        {
+            for (int k = 1; k < _nCal; k++)
+            {
+                if (h < level[k])
+                {
+                    if (h > level[k - 1])
+                        e = error[k - 1] + (error[k] - error[k - 1]) * (h - level[k - 1]) / (level[k] - level[k - 1]);
+                    break;
+                }
+            }
+        }
+
+        float value = constrain(_lut[i] + e * 65535, 0.0f, 65535.0f);
+        _lut[i] = max(prev, (uint16_t)value); // the volume never decreases with the level
+        prev = _lut[i];
+    }
+}
+
+// Lookup with linear interpolation in fixed point: the table position is Q8 (1/256 of a segment)
+uint16_t Tank::_fraction(float distance)
+{
+    float level = _height + _offset - distance;
+    if (level <= 0)
+        return 0;
+    if (level >= _height)
+        return 65535;
+
+    uint32_t pos = level * _scale;
+    uint32_t i = pos >> 8;
+    uint32_t frac = pos & 0xFF;
+    if (i >= TANK_SEGMENTS)
+        return _lut[TANK_SEGMENTS];
+
+    return _lut[i] + (((int32_t)_lut[i + 1] - _lut[i]) * (int32_t)frac >> 8);
+}
+
+float Tank::gallons(float distance)
+{
+    return _fraction(distance) * _capacity / 65535;
+}
+
+float Tank::percent(float distance)
+{
+    return _fraction(distance) * 100.0 / 65535;
+}
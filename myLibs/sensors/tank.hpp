@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define TANK_SEGMENTS 64  // Lookup table segments over the tank height
+#define TANK_MAX_CAL 8    // Max number of calibration points
+#define CM3_PER_GAL 3785.41
+
+enum TankShape
+{
+    TS_Vertical,   // Constant cross-section: upright box or upright cylinder
+    TS_Horizontal, // Horizontal cylinder, height is the diameter
+    TS_Oval        // Obround (e.g., 275 gal oil tank): flat sides with half-round top and bottom
+};
+
+/*
+Tank model converting the measured distance to volume. The geometry is compiled at boot
+into a fixed-point lookup table of the filled fraction over the level, so a conversion
+is a table lookup with linear interpolation instead of acos/sqrt in soft-float.
+Optional calibration points (distance, gallons) correct the model, e.g., with the
+manufacturer strapping chart.
+*/
+class Tank
+{
+public:
+    // Dimensions in cm. offset is the distance from the sensor to the full level.
+    // length is the depth of a vertical box (width x length footprint), 0 for an upright cylinder of diameter width.
+    // capacity (gal) overrides the computed one if > 0, e.g., the nameplate capacity.
+    void reset(TankShape shape, float height, float width, float length, float offset, float capacity = 0);
+    bool addCalibration(float distance, float gallons); // call before build()
+    void build();                                       // compile the lookup table
+
+    float gallons(float distance);
+    float percent(float distance);
+    float capacity() { return _capacity; };
+
+    static TankShape shapeOf(const char *name); // "vertical", "horizontal" or "oval"
+
+private:
+    TankShape _shape = TS_Vertical;
+    float _height = 0;
+    float _width = 0;
+    float _length = 0;
+    float _offset = 0;
+    float _capacity = 0; // gallons
+
+    float _calDistance[TANK_MAX_CAL];
+    float _calGallons[TANK_MAX_CAL];
+    int _nCal = 0;
+
+    uint16_t _lut[TANK_SEGMENTS + 1]; // filled fraction (65535 is full) at level i * height / TANK_SEGMENTS
+    float _scale = 0;                 // level (cm) to table position in 1/256 of a segment
+
+    uint16_t _fraction(float distance); // filled fraction, 65535 is full
+    float _area(float level);           // cross-section area (cm2) below the level
+    static float _segment(float r, float h); // area of a circle segment of height h
+};
@@ -1,30 +1,96 @@
 #include "vl53l0x.hpp"
 
+#include <Wire.h>
+
+// Registers of the reference calibration, as VL53L0X_PerformRefCalibration() of the ST API.
+// The Adafruit driver does not expose it, nor its device handle.
+#define VL53_ADDR 0x29 // VL53L0X_I2C_ADDR, begin() default
+#define VL53_SYSRANGE_START 0x00
+#define VL53_SEQUENCE_CONFIG 0x01
+#define VL53_INTERRUPT_CLEAR 0x0B
+#define VL53_INTERRUPT_STATUS 0x13
+
+static void writeReg(uint8_t reg, uint8_t value)
+{
+    Wire.beginTransmission(VL53_ADDR);
+    Wire.write(reg);
+    Wire.write(value);
+    Wire.endTransmission();
+}
+
+static uint8_t readReg(uint8_t reg)
+{
+    Wire.beginTransmission(VL53_ADDR);
+    Wire.write(reg);
+    Wire.endTransmission();
+    Wire.requestFrom((uint8_t)VL53_ADDR, (uint8_t)1);
+    return Wire.read();
+}
+
+// One calibration step: VHV (sequence 0x01, start 0x40) or phase (sequence 0x02, start 0x00)
+static bool refCalibrationStep(uint8_t sequence, uint8_t start)
+{
+    writeReg(VL53_SEQUENCE_CONFIG, sequence);
+    writeReg(VL53_SYSRANGE_START, 0x01 | start);
+
+    unsigned long t0 = millis();
+    bool done;
+    while (!(done = (readReg(VL53_INTERRUPT_STATUS) & 0x07) != 0) && millis() - t0 < VL53_CAL_TIMEOUT)
+        yield();
+
+    writeReg(VL53_INTERRUPT_CLEAR, 0x01);
+    writeReg(VL53_SYSRANGE_START, 0x00);
+    return done;
+}
+
+// Measure channel names
+static const char *const CHANNELS[] = {"distance"};
+
 VL53L0X::VL53L0X(const char *name)
     : Sensor(name, 1, Median)
 {
-    if (!_lox.begin())
-    {
-        Serial.println("Failed to boot VL53L0X");
-        _ready = false;
-    }
-    else
+    _channels = CHANNELS;
+    _begin();
+}
+
+// A failed boot is retried by _read(), the delay doubling up to VL53_RETRY_CAP
+bool VL53L0X::_begin()
+{
+    _ready = _lox.begin();
+    if (_ready)
     {
-        _ready = true;
+        _retryDelay = 0;
+        return true;
     }
+
+    _failedAt = millis();
+    _retryDelay = _retryDelay == 0 ? VL53_RETRY_BASE : min(_retryDelay * 2, (uint32_t)VL53_RETRY_CAP);
+    Serial.printf("Failed to boot VL53L0X, retry in %lu s\n", (unsigned long)_retryDelay / 1000);
+    return false;
+}
+
+// Reference calibration only, the SPAD and offset calibrations of begin() are kept
+bool VL53L0X::_recalibrate()
+{
+    uint8_t sequence = readReg(VL53_SEQUENCE_CONFIG);
+    bool ok = refCalibrationStep(0x01, 0x40) && refCalibrationStep(0x02, 0x00);
+    writeReg(VL53_SEQUENCE_CONFIG, sequence);
+    return ok;
 }
 
 // _timestamp is the one of the lastest measure
 char *VL53L0X::getPayload()
 {
-    static char payload[50];
+    static char payload[140];
     // snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"distance\":%.1f}",
     //          _timestamp*1000, _measures[0]);
 
     if (!_bands[0]->status)
         return NULL;
 
-    snprintf(payload, sizeof(payload), "{\"timestamp\":%lld,\"distance\":%.1f}", _timestamp, _measures[0]);
+    int n = _stamp(payload, sizeof(payload));
+    snprintf(payload + n, sizeof(payload) - n, ",\"distance\":%.1f}", _measures[0]);
+    _appendTank(payload, sizeof(payload), _measures[0]);
     return payload;
 }
 
@@ -33,11 +99,34 @@ bool VL53L0X::_read()
 {
     bool res = false;
 
+    if (!_ready && millis() - _failedAt >= _retryDelay)
+        _begin();
+
     if (_ready)
     {
+        // The time of flight does not depend on the air, but the VCSEL and reference SPADs drift
+        // with temperature. Redo the reference calibration (done by begin()) on large changes,
+        // as ST recommends for 8C; a failed one is tried again on the next read.
+        float airTemp = _air.temperature();
+        if (isnan(_calTemp))
+        {
+            _calTemp = airTemp;
+        }
+        else if (fabs(airTemp - _calTemp) >= VL53_RECAL_TEMP && _recalibrate())
+        {
+            _calTemp = airTemp;
+#ifdef _DEBUG
+            Serial.printf("%s: recalibrated at %.1fC\n", name, airTemp);
+#endif
+        }
+
         VL53L0X_RangingMeasurementData_t measure;
         _lox.rangingTest(&measure, false); // pass in 'true' to get debug data printout!
 
+        // RangeStatus: 0 valid, 1 sigma fail, 2 signal fail, 3 min range fail, 4 phase fail
+        static const float CONFIDENCE[] = {1.0, 0.5, 0.5, 0.25, 0};
+        _confidence = measure.RangeStatus < 4 ? CONFIDENCE[measure.RangeStatus] : 0;
+
         if (measure.RangeStatus != 4)
         { // phase failures have incorrect data
             _measures[0] = measure.RangeMilliMeter / 10.0;
@@ -3,6 +3,11 @@
 #include "sensor.hpp"
 #include "Adafruit_VL53L0X.h"
 
+#define VL53_RECAL_TEMP 8.0  // Air temperature change (C) triggering a reference calibration
+#define VL53_RETRY_BASE 5e3  // Delay before booting a failed sensor again, doubled on each failure
+#define VL53_RETRY_CAP 300e3 // Max delay between boot attempts (ms)
+#define VL53_CAL_TIMEOUT 100 // Reference calibration step timeout (ms)
+
 /*
  * Laser distance sensor using I2C
  */
@@ -15,6 +20,12 @@ public:
 private:
     bool _ready = false;
     Adafruit_VL53L0X _lox = Adafruit_VL53L0X();
+    float _calTemp = NAN; // air temperature at the last reference calibration
+    unsigned long _failedAt = 0; // millis() of the last failed begin()
+    uint32_t _retryDelay = 0;    // until the next begin(), 0 if booted
+
+    bool _begin();       // boot and calibrate the sensor
+    bool _recalibrate(); // redo the reference (VHV and phase) calibration of a running sensor
 
     virtual bool _read();
 };
@@ -0,0 +1,37 @@
+#include "window.hpp"
+
+void Window::reset(int index, unsigned long period, unsigned long now)
+{
+    this->index = index;
+    this->period = period;
+    restart(now);
+}
+
+void Window::restart(unsigned long now)
+{
+    start = now;
+    count = 0;
+    mean = 0;
+    _m2 = 0;
+}
+
+// https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm
+void Window::add(double measure)
+{
+    if (count == 0)
+    {
+        min = max = measure;
+    }
+    else
+    {
+        if (measure < min)
+            min = measure;
+        if (measure > max)
+            max = measure;
+    }
+
+    count++;
+    double delta = measure - mean;
+    mean += delta / count;
+    _m2 += delta * (measure - mean);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <math.h>
+
+#define MAX_WINDOWS 4 // Max number of aggregation windows per sensor
+
+/*
+ * Window: rolling aggregation (count/min/max/mean/stddev) of one measure channel
+ * over a fixed period. Mean and variance are updated in O(1) with Welford's algorithm.
+ */
+class Window
+{
+public:
+    Window() {};
+    virtual ~Window() {};
+
+    void reset(int index, unsigned long period, unsigned long now); // index: measure channel, period (ms)
+
+    bool isDone(unsigned long now) const { return now - start >= period; }; // window period elapsed
+    void restart(unsigned long now);                                      // start a new window
+    void add(double measure);                                             // add a measure into the window
+
+    float stddev() const { return count > 1 ? sqrt(_m2 / (count - 1)) : 0; }; // sample standard deviation
+
+    int index = 0;            // measure channel
+    unsigned long period = 0; // window length (ms)
+    unsigned long start = 0;  // window start time (ms)
+
+    unsigned long count = 0;
+    float min = 0;
+    float max = 0;
+    double mean = 0;
+
+private:
+    double _m2 = 0; // sum of squared differences from the mean
+};
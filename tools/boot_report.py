@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+Aggregate the boot reports (<module>/boot) of the fleet.
+
+Each device publishes one retained boot report after its first MQTT connect, with the
+time (ms since power up) at the end of each setup phase and of the first connection events.
+This tool turns them into per-phase durations and prints the fleet statistics, so the
+slowest phases of the recovery after a power outage stand out.
+
+Input is the output of mosquitto_sub -v (one "<topic> <payload>" per line), e.g.,
+    mosquitto_sub -h raspberrypi -t '+/boot' -v -W 5 > boot.log
+    python3 boot_report.py boot.log
+or live from the broker (requires paho-mqtt):
+    python3 boot_report.py --host raspberrypi --wait 5
+"""
+
+import argparse
+import json
+import statistics
+import sys
+
+# Phases in order: (name, start event, end event). Durations are end - start.
+PHASES = [
+    ('boot', None, 'start'),        # power up to setup(), bootloader and core init
+    ('config', 'start', 'config'),
+    ('portal', 'config', 'portal'),
+    ('wifi_setup', 'portal', 'wifi'),
+    ('ota', 'wifi', 'ota'),
+    ('mqtt_setup', 'ota', 'mqtt'),
+    ('wifi_join', 'mqtt', 'join'),  # Wi-Fi join started in setup(), connected at 'ip'
+    ('sensors', 'join', 'sensors'),
+    ('setup_rest', 'sensors', 'setup'),
+    ('broker_lookup', 'ip', 'dns'),  # first broker address known, about 0 if cached across a restart
+    ('mqtt_connect', 'setup', 'conn'),
+    ('ntp_sync', 'setup', 'ntp'),
+]
+
+# Totals from power up
+TOTALS = [('got_ip', 'ip'), ('mqtt_connected', 'conn'), ('ntp_synced', 'ntp'), ('setup_done', 'setup')]
+
+
+def parse_line(line):
+    """Return (module, report) from a mosquitto_sub -v line, None if not a boot report."""
+    line = line.strip()
+    if not line:
+        return None
+
+    topic, _, payload = line.partition(' ')
+    if not topic.endswith('/boot'):
+        return None
+
+    try:
+        report = json.loads(payload)
+    except ValueError:
+        print('Invalid report: %s' % line, file=sys.stderr)
+        return None
+
+    return topic[:-len('/boot')], report
+
+
+def durations(report):
+    """Per-phase durations (ms) of one report. Events not reached (0) are skipped."""
+    result = {}
+    for name, start, end in PHASES:
+        t1 = report.get(end, 0)
+        t0 = report.get(start, 0) if start else 0
+        if t1 > 0 and (start is None or t0 > 0) and t1 >= t0:
+            result[name] = t1 - t0
+
+    for name, event in TOTALS:
+        if report.get(event, 0) > 0:
+            result[name] = report[event]
+
+    return result
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100.0
+    i = int(k)
+    j = min(i + 1, len(values) - 1)
+    return values[i] + (values[j] - values[i]) * (k - i)
+
+
+def summarize(reports):
+    """Print fleet statistics per phase and the slowest device of each."""
+    per_phase = {}
+    for module, report in reports.items():
+        for name, value in durations(report).items():
+            per_phase.setdefault(name, []).append((value, module))
+
+    names = [name for name, _, _ in PHASES] + [name for name, _ in TOTALS]
+
+    print('%d device(s)\n' % len(reports))
+    print('%-15s %5s %8s %8s %8s %8s  %s' % ('phase (ms)', 'n', 'median', 'p90', 'max', 'mean', 'slowest'))
+    for name in names:
+        samples = per_phase.get(name)
+        if not samples:
+            continue
+
+        values = [v for v, _ in samples]
+        slowest = max(samples)
+        print('%-15s %5d %8.0f %8.0f %8d %8.0f  %s' % (name, len(values), statistics.median(values),
+                                                      percentile(values, 90), slowest[0],
+                                                      statistics.mean(values), slowest[1]))
+        if name == 'setup_rest':
+            print()
+
+    reasons = {}
+    for report in reports.values():
+        reason = report.get('reset', '?')
+        reasons[reason] = reasons.get(reason, 0) + 1
+
+    print('\nreset reasons: ' + ', '.join('%s: %d' % kv for kv in sorted(reasons.items())))
+
+
+def read_files(files):
+    reports = {}
+    for f in files:
+        stream = sys.stdin if f == '-' else open(f)
+        for line in stream:
+            parsed = parse_line(line)
+            if parsed:
+                reports[parsed[0]] = parsed[1]  # latest report per device
+    return reports
+
+
+def read_broker(host, port, wait):
+    import time
+    import paho.mqtt.client as mqtt
+
+    reports = {}
+
+    def on_message(client, userdata, msg):
+        parsed = parse_line('%s %s' % (msg.topic, msg.payload.decode(errors='replace')))
+        if parsed:
+            reports[parsed[0]] = parsed[1]
+
+    client = mqtt.Client()
+    client.on_message = on_message
+    client.connect(host, port)
+    client.subscribe('+/boot')
+    client.loop_start()
+    time.sleep(wait)  # retained reports arrive right after subscribing
+    client.loop_stop()
+    return reports
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Aggregate device boot reports across the fleet.')
+    parser.add_argument('files', nargs='*', default=['-'], help='mosquitto_sub -v output, - for stdin')
+    parser.add_argument('--host', help='read the retained reports from this MQTT broker instead')
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--wait', type=float, default=3, help='seconds to collect retained reports')
+    parser.add_argument('--json', action='store_true', help='dump the per-device durations as JSON')
+    args = parser.parse_args()
+
+    reports = read_broker(args.host, args.port, args.wait) if args.host else read_files(args.files)
+    if not reports:
+        print('No boot report found.', file=sys.stderr)
+        return 1
+
+    if args.json:
+        print(json.dumps({module: durations(r) for module, r in reports.items()}, indent=2))
+    else:
+        summarize(reports)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Pack a firmware image for the resumable OTA of the device (/api/ota/*), and push it to the fleet.
+
+pack: gzip the firmware (ESP8266 only, the bootloader decompresses it at the next boot), e.g.,
+    python3 ota_pack.py pack .pio/build/d1_mini/firmware.bin
+writes firmware.bin.gz and prints its size and MD5.
+
+upload: send an image in CRC-checked chunks. A chunk that fails or a dropped connection is
+resumed from the offset the device expects next, not from zero, e.g.,
+    python3 ota_pack.py upload firmware.bin.gz oilgauge.local sumppit.local --jobs 2
+The device verifies the MD5 of the whole image and restarts into it.
+Only the standard library is used.
+"""
+
+import argparse
+import concurrent.futures
+import gzip
+import hashlib
+import json
+import sys
+import time
+import urllib.error
+import urllib.request
+import zlib
+
+CHUNK = 2048  # OTA_CHUNK of the firmware, max
+
+
+def pack(path, output):
+    with open(path, 'rb') as f:
+        image = f.read()
+
+    packed = gzip.compress(image, 9, mtime=0)
+    output = output or path + '.gz'
+    with open(output, 'wb') as f:
+        f.write(packed)
+
+    print('%s: %d -> %d bytes (%.0f%%), md5 %s'
+          % (output, len(image), len(packed), 100.0 * len(packed) / len(image), hashlib.md5(packed).hexdigest()))
+
+
+def request(host, path, data=None, timeout=20):
+    """POST (data not None) or GET, return (HTTP code, status dict)."""
+    req = urllib.request.Request('http://%s%s' % (host, path), data=data, method='POST' if data is not None else 'GET')
+    if data is not None:
+        req.add_header('Content-Type', 'application/octet-stream')
+    try:
+        with urllib.request.urlopen(req, timeout=timeout) as response:
+            return response.status, json.loads(response.read())
+    except urllib.error.HTTPError as e:
+        body = e.read()
+        try:
+            return e.code, json.loads(body)
+        except ValueError:
+            return e.code, {'error': body.decode(errors='replace')}
+
+
+def upload(host, image, chunk, retries, log):
+    md5 = hashlib.md5(image).hexdigest()
+    failures = 0
+    start = time.time()
+
+    while True:
+        try:
+            # begin also resumes the session of the same image after an interruption
+            code, status = request(host, '/api/ota/begin?size=%d&md5=%s' % (len(image), md5), b'')
+            if code != 200:
+                log('%s: begin failed: %s' % (host, status.get('error')))
+                return False
+
+            offset = status['next']
+            if offset > 0:
+                log('%s: resuming at %d' % (host, offset))
+
+            while offset < len(image):
+                data = image[offset:offset + chunk]
+                code, status = request(host, '/api/ota/chunk?offset=%d&crc=%08x' % (offset, zlib.crc32(data)), data)
+                if code == 200:
+                    offset = status['next']
+                    failures = 0
+                else:
+                    # rejected: resend from where the device is
+                    failures += 1
+                    if status.get('state') != 'receiving' or failures > retries:
+                        log('%s: chunk at %d failed: %s' % (host, offset, status.get('error')))
+                        return False
+                    offset = status['next']
+
+                log('%s: %d/%d bytes (%.0f%%)' % (host, offset, len(image), 100.0 * offset / len(image)), progress=True)
+
+            code, status = request(host, '/api/ota/end', b'')
+            if code != 200:
+                log('%s: verification failed: %s' % (host, status.get('error')))
+                return False
+
+            log('%s: done in %.0fs, restarting' % (host, time.time() - start))
+            return True
+
+        except (OSError, ValueError, KeyError) as e:
+            # dropped connection: wait and resume
+            failures += 1
+            if failures > retries:
+                log('%s: giving up: %s' % (host, e))
+                return False
+            log('%s: %s, retrying' % (host, e))
+            time.sleep(min(2 ** failures, 30))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    p = commands.add_parser('pack', help='gzip a firmware image')
+    p.add_argument('firmware')
+    p.add_argument('-o', '--output', help='output file, <firmware>.gz by default')
+
+    u = commands.add_parser('upload', help='upload an image to the devices')
+    u.add_argument('image', help='firmware.bin or firmware.bin.gz')
+    u.add_argument('hosts', nargs='+', help='device host names or IPs')
+    u.add_argument('--chunk', type=int, default=CHUNK, help='chunk size, max %d' % CHUNK)
+    u.add_argument('--retries', type=int, default=10, help='consecutive failures before giving up')
+    u.add_argument('--jobs', type=int, default=1, help='devices updated in parallel')
+
+    args = parser.parse_args()
+
+    if args.command == 'pack':
+        pack(args.firmware, args.output)
+        return 0
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    single = len(args.hosts) == 1
+
+    def log(msg, progress=False):
+        # progress lines only for a single device, they would interleave otherwise
+        if not progress:
+            print(('\n' if single else '') + msg)
+        elif single:
+            print('\r' + msg, end='', flush=True)
+
+    chunk = min(args.chunk, CHUNK)
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        results = dict(zip(args.hosts, pool.map(lambda host: upload(host, image, chunk, args.retries, log), args.hosts)))
+
+    failed = [host for host, ok in results.items() if not ok]
+    print('%d/%d updated%s' % (len(results) - len(failed), len(results), (', failed: ' + ' '.join(failed)) if failed else ''))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+Turn the profile report of the /cmd/profile command into a per-function profile.
+
+The device publishes the report of a run in parts on <module>/profile. In pc mode each part
+holds sampled program counters (16 bytes of code each) and their sample counts; they are
+resolved against the firmware ELF with addr2line and aggregated per function. In tag mode the
+parts hold the count and time (us) per timer action, sensor read and loop phase.
+
+Input is the output of mosquitto_sub -v (one "<topic> <payload>" per line), e.g.,
+    mosquitto_pub -h raspberrypi -t 'oilgauge/cmd/profile' -m '10,pc'
+    mosquitto_sub -h raspberrypi -t 'oilgauge/profile' -v -W 30 > profile.log
+    python3 profile_symbolize.py --elf .pio/build/d1_mini/firmware.elf profile.log
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+
+
+def parse_runs(lines):
+    """Merge the report parts by (module, run), return {(module, run): report}."""
+    runs = {}
+    for line in lines:
+        line = line.strip()
+        if not line:
+            continue
+
+        topic, _, payload = line.partition(' ')
+        if not topic.endswith('/profile'):
+            continue
+
+        try:
+            part = json.loads(payload)
+        except ValueError:
+            print('Invalid part: %s' % line, file=sys.stderr)
+            continue
+
+        key = (topic[:-len('/profile')], part.get('run', 0))
+        report = runs.setdefault(key, {'pc': {}, 'tag': {}, 'parts': set(), 'last': None})
+        for field in ('mode', 'secs', 'samples', 'lost', 'hz'):
+            if field in part:
+                report[field] = part[field]
+        report['pc'].update(part.get('pc', {}))
+        report['tag'].update(part.get('tag', {}))
+        report['parts'].add(part.get('part', 0))
+        if part.get('last'):
+            report['last'] = part.get('part', 0)
+
+    return runs
+
+
+def complete(report):
+    """True if all the parts of the run were received."""
+    return report['last'] is not None and len(report['parts']) == report['last'] + 1
+
+
+def symbolize(addresses, elf, addr2line):
+    """Return {address: function} using addr2line on the firmware ELF."""
+    if not addresses:
+        return {}
+
+    cmd = [addr2line, '-f', '-C', '-e', elf] + ['0x%s' % a for a in addresses]
+    try:
+        out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        print('addr2line failed (%s), reporting raw addresses' % e, file=sys.stderr)
+        return {a: '0x%s' % a for a in addresses}
+
+    # two lines per address: function, file:line
+    lines = out.splitlines()
+    return {a: lines[2 * i] if 2 * i < len(lines) else '??' for i, a in enumerate(addresses)}
+
+
+def print_pc(module, run, report, elf, addr2line, top):
+    samples = report.get('samples', 0)
+    print('%s run %d: pc mode, %.1fs, %d samples at %dHz, %d lost'
+          % (module, run, report.get('secs', 0), samples, report.get('hz', 0), report.get('lost', 0)))
+
+    names = symbolize(sorted(report['pc']), elf, addr2line) if elf else {a: '0x%s' % a for a in report['pc']}
+
+    functions = {}
+    for address, count in report['pc'].items():
+        name = names.get(address, '??')
+        functions[name] = functions.get(name, 0) + count
+
+    # samples not in the report: the tail of the table beyond the top slots
+    reported = sum(functions.values())
+    if samples > reported:
+        functions['(other)'] = samples - reported
+
+    print('%8s %6s  %s' % ('samples', '%', 'function'))
+    for name, count in sorted(functions.items(), key=lambda x: -x[1])[:top]:
+        print('%8d %5.1f%%  %s' % (count, 100.0 * count / max(samples, 1), name))
+
+
+def print_tag(module, run, report, top):
+    secs = report.get('secs', 0)
+    print('%s run %d: tag mode, %.1fs' % (module, run, secs))
+
+    print('%-24s %8s %10s %8s %6s' % ('tag', 'count', 'total_ms', 'mean_us', '%'))
+    tags = sorted(report['tag'].items(), key=lambda x: -x[1][1])
+    for name, (count, us) in tags[:top]:
+        print('%-24s %8d %10.1f %8.0f %5.1f%%'
+              % (name, count, us / 1000.0, us / max(count, 1), 100.0 * us / 1e6 / max(secs, 1e-3)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', nargs='?', help='mosquitto_sub -v output, stdin if omitted')
+    parser.add_argument('--elf', help='firmware ELF of the running build, addresses are not resolved without it')
+    parser.add_argument('--addr2line', default='xtensa-lx106-elf-addr2line', help='addr2line of the toolchain')
+    parser.add_argument('--top', type=int, default=30, help='number of rows printed')
+    args = parser.parse_args()
+
+    with (open(args.log) if args.log else sys.stdin) as f:
+        runs = parse_runs(f)
+
+    if not runs:
+        print('No profile report found', file=sys.stderr)
+        return 1
+
+    for (module, run), report in sorted(runs.items()):
+        if not complete(report):
+            print('%s run %d: incomplete, %d parts received' % (module, run, len(report['parts'])), file=sys.stderr)
+
+        if report.get('mode') == 'tag':
+            print_tag(module, run, report, args.top)
+        else:
+            print_pc(module, run, report, args.elf, args.addr2line, args.top)
+        print()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
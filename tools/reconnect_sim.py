@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+Simulate the MQTT reconnects of a fleet after a broker restart.
+
+All devices lose the broker at the same time. The broker is down for --down seconds, then
+accepts at most --capacity connections per second (a Pi busy restoring sessions), an attempt
+over the capacity fails. Each device retries with:
+  fixed    the former fixed MQTT_RECONNECT_INTERVAL (5s): the fleet retries in lockstep
+  backoff  Backoff (myLibs/network/Backoff.cpp): delay drawn in [d/4, d], d = min(cap, base * 2^n)
+and the attempts per second are printed for both, e.g.,
+    python3 reconnect_sim.py --devices 100 --down 30 --capacity 10
+"""
+
+import argparse
+import heapq
+import random
+
+
+def fixed_policy(interval):
+    def delay(attempt):
+        return interval
+    return delay
+
+
+def backoff_policy(base, cap):
+    # same as Backoff::next()
+    def delay(attempt):
+        d = min(cap, base * 2 ** min(attempt, 16))
+        return random.uniform(d / 4, d)
+    return delay
+
+
+def simulate(devices, down, capacity, delay, detect):
+    """Return (attempts per second, time all online, total attempts)."""
+    events = []  # (time, device, attempt)
+    for device in range(devices):
+        # disconnect detected with some spread (keep alive, TCP reset), then the first retry delay
+        heapq.heappush(events, (random.uniform(0, detect) + delay(0), device, 0))
+
+    per_second = {}
+    accepted = {}
+    online = 0
+    last = 0.0
+    total = 0
+
+    while events:
+        t, device, attempt = heapq.heappop(events)
+        second = int(t)
+        per_second[second] = per_second.get(second, 0) + 1
+        total += 1
+
+        if t >= down and accepted.get(second, 0) < capacity:
+            accepted[second] = accepted.get(second, 0) + 1
+            online += 1
+            last = t
+        else:
+            heapq.heappush(events, (t + delay(attempt + 1), device, attempt + 1))
+
+    return per_second, last, total
+
+
+def report(name, per_second, last, total, width):
+    peak = max(per_second.values())
+    print('%s: all online after %.1fs, %d attempts, peak %d attempts/s' % (name, last, total, peak))
+    end = int(last) + 1
+    for second in range(end):
+        n = per_second.get(second, 0)
+        print('%5ds %4d %s' % (second, n, '#' * (n * width // peak)))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--devices', type=int, default=50)
+    parser.add_argument('--down', type=float, default=20, help='broker down time (s)')
+    parser.add_argument('--capacity', type=int, default=10, help='connections accepted per second')
+    parser.add_argument('--detect', type=float, default=1, help='spread of the disconnect detection (s)')
+    parser.add_argument('--interval', type=float, default=5, help='fixed policy retry interval (s)')
+    parser.add_argument('--base', type=float, default=2, help='MQTT_RETRY_BASE (s)')
+    parser.add_argument('--cap', type=float, default=120, help='MQTT_RETRY_CAP (s)')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--width', type=int, default=50, help='chart width')
+    args = parser.parse_args()
+
+    for name, policy in (('fixed', fixed_policy(args.interval)), ('backoff', backoff_policy(args.base, args.cap))):
+        random.seed(args.seed)
+        per_second, last, total = simulate(args.devices, args.down, args.capacity, policy, args.detect)
+        report(name, per_second, last, total, args.width)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,210 @@
+/*
+Host decoder of the firmware trace dump (see myLibs/network/Trace.hpp).
+The records keep the event ID and raw arguments only; the formats come from the
+shared event table myLibs/network/TraceEvents.h, so build it from the same source tree
+as the firmware:
+
+    g++ -std=c++17 -O2 -I../myLibs/network -o trace_decode trace_decode.cpp
+
+Get a dump from the device and decode it, e.g.,
+
+    curl -o trace.bin http://oilgauge.local/api/trace          (live ring buffer)
+    curl -o trace.bin "http://oilgauge.local/api/trace?saved"  (saved at the last restart/crash)
+    mosquitto_sub -h raspberrypi -t OilGauge/trace -N > trace.bin  (after publishing OilGauge/cmd/trace)
+    ./trace_decode trace.bin
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "TraceEvents.h"
+
+static const char *const NAMES[] = {
+#define TRACE_EVENT(id, format) #id,
+    TRACE_EVENTS
+#undef TRACE_EVENT
+};
+
+static const char *const FORMATS[] = {
+#define TRACE_EVENT(id, format) format,
+    TRACE_EVENTS
+#undef TRACE_EVENT
+};
+
+// Format the arguments with the event format, one conversion per 32-bit word
+static std::string format(const char *fmt, const uint32_t *args, int n)
+{
+    std::string out;
+    char spec[16];
+    char buf[64];
+    int k = 0;
+
+    for (const char *p = fmt; *p; p++)
+    {
+        if (*p != '%')
+        {
+            out += *p;
+            continue;
+        }
+
+        if (p[1] == '%')
+        {
+            out += '%';
+            p++;
+            continue;
+        }
+
+        // copy the conversion spec, e.g., %08x, %.2f
+        size_t len = strspn(p + 1, "0123456789.-+ #l");
+        char conv = p[1 + len];
+        if (len + 3 > sizeof(spec) || conv == '\0')
+        {
+            out += p;
+            break;
+        }
+        memcpy(spec, p, len + 1);
+        spec[len + 1] = conv;
+        spec[len + 2] = '\0';
+        p += len + 1;
+
+        // drop the length modifiers, a word is 32 bits
+        std::string s(spec);
+        for (size_t i; (i = s.find('l')) != std::string::npos;)
+            s.erase(i, 1);
+
+        if (k >= n)
+        {
+            out += "<?>";
+            continue;
+        }
+
+        uint32_t word = args[k++];
+        switch (conv)
+        {
+        case 'f':
+        case 'e':
+        case 'g':
+        {
+            float value;
+            memcpy(&value, &word, sizeof(value));
+            snprintf(buf, sizeof(buf), s.c_str(), (double)value);
+            break;
+        }
+        case 'd':
+        case 'i':
+            snprintf(buf, sizeof(buf), s.c_str(), (int32_t)word);
+            break;
+        case 'c':
+            snprintf(buf, sizeof(buf), s.c_str(), (int)word);
+            break;
+        default: // u, x, X, o
+            snprintf(buf, sizeof(buf), s.c_str(), word);
+            break;
+        }
+        out += buf;
+    }
+
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <trace.bin> [--raw]\n", argv[0]);
+        return 1;
+    }
+
+    bool raw = argc > 2 && strcmp(argv[2], "--raw") == 0;
+
+    FILE *file = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+        data.insert(data.end(), chunk, chunk + n);
+    if (file != stdin)
+        fclose(file);
+
+    TraceHeader header;
+    if (data.size() < sizeof(header))
+    {
+        fprintf(stderr, "Too short for a trace dump: %zu bytes\n", data.size());
+        return 1;
+    }
+
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "Not a trace dump (bad magic)\n");
+        return 1;
+    }
+
+    if (header.recordSize != sizeof(TraceRecord))
+    {
+        fprintf(stderr, "Record size %u does not match this decoder (%zu), rebuild it from the firmware source\n",
+                header.recordSize, sizeof(TraceRecord));
+        return 1;
+    }
+
+    size_t count = header.count;
+    size_t available = (data.size() - sizeof(header)) / sizeof(TraceRecord);
+    if (available < count)
+    {
+        fprintf(stderr, "Truncated dump: %zu of %zu records\n", available, count);
+        count = available;
+    }
+
+    const TraceRecord *records = (const TraceRecord *)(data.data() + sizeof(header));
+
+    // micros() wraps every ~71 min: the age of a record is the wrapping difference to the dump time
+    for (size_t i = 0; i < count; i++)
+    {
+        const TraceRecord &record = records[i];
+        double age = (uint32_t)(header.now - record.us) / 1e6; // seconds before the dump
+
+        char when[40];
+        if (header.epoch != 0)
+        {
+            double t = header.epoch - age;
+            time_t sec = (time_t)t;
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            size_t n = strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+            snprintf(when + n, sizeof(when) - n, ".%06d", (int)((t - sec) * 1e6));
+        }
+        else
+        {
+            snprintf(when, sizeof(when), "-%.6fs", age);
+        }
+
+        if (record.id >= EV_COUNT || record.n > TRACE_MAX_ARGS)
+        {
+            printf("%s  <unknown event %u>\n", when, record.id);
+            continue;
+        }
+
+        if (raw)
+        {
+            printf("%s  %-16s", when, NAMES[record.id]);
+            for (int k = 0; k < record.n; k++)
+                printf(" 0x%08x", record.args[k]);
+            printf("\n");
+        }
+        else
+        {
+            printf("%s  %s\n", when, format(FORMATS[record.id], record.args, record.n).c_str());
+        }
+    }
+
+    return 0;
+}